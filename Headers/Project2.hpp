@@ -18,11 +18,20 @@
 #include <shader.hpp>
 #include <camera.hpp>
 #include <heightmap.hpp>
+#include <terrain.hpp>
+#include <terrain_stream.hpp>
 #include <track.hpp>
+#include <train.hpp>
+#include <simulation.hpp>
 #include <model.hpp>
+#include <benchmark.hpp>
+
+// Uncomment to print timing benchmarks to the console at startup
+//#define RUN_BENCHMARKS
 
 // Basic C++ and C headers
 #include <iostream>
+#include <memory>
 #include <string>
 #include <limits>
 
@@ -70,6 +79,21 @@ bool drawSpecular = false;
 bool use_quats = true;
 bool drawNormals = false;
 bool drawTrack = true;
+bool printTrackInfo = false;
+// tessellate the track by curvature and torsion instead of a sample every 0.1 of a segment
+bool adaptiveTrack = false;
+// build the rails and ties in the vertex shaders from the track frames, only the frames are uploaded
+bool extrudeTrackOnGPU = false;
+// keep the generated track data in spline/track.sp.meshcache, which can run to hundreds of MB, and load it on later runs
+bool cacheTrackMesh = false;
+// write spline/track.spb with the frames after loading the track, later runs open it instead of the text track
+bool compileTrack = false;
+// upload the heightmap as a texture and lift a small grid over it in the vertex shader, instead of a vertex for every texel
+bool displaceHeightmapOnGPU = false;
+// draw the heightmap as quadtree tiles with distance based level of detail instead of its full mesh
+bool drawTerrainLOD = false;
+// stream the terrain in tiles around the camera from heightmaps/terrain.rht, written from the heightmap the first time
+bool streamTerrain = false;
 
 // Transformation Matrices
 glm::vec3 translation   = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -78,6 +102,14 @@ glm::vec3 rotation_euler      = glm::vec3(0.0f, 0.0f, 0.0f);
 glm::quat rotation   =   glm::quat(glm::vec3(0.0f, 0.0f, 0.0f));
 glm::vec3 scale         = glm::vec3(1.0f, 1.0f, 1.0f);
 
+// Distance between track ties
+float tieSpacing = 0.2f;
+
+// Trains running round the track as well as the ridden car, cars per train and distance between their cars
+int parkTrains = 3;
+int trainCars = 4;
+float trainCarSpacing = 0.35f;
+
 // Step size of transformations
 float step_multiplier = 1.0f;
 
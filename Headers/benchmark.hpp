@@ -0,0 +1,1092 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <ride.hpp>
+#include <simulation.hpp>
+#include <heightmap.hpp>
+#include <terrain.hpp>
+#include <terrain_stream.hpp>
+#include <track.hpp>
+#include <track_stream.hpp>
+#include <train.hpp>
+
+// Timing helpers that print to the console at startup. Enable with RUN_BENCHMARKS in Project2.hpp
+
+// seconds elapsed since start
+inline double seconds_since(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Bytes of the process in physical memory, 0 where it cannot be read
+inline size_t resident_memory()
+{
+#ifdef __linux__
+	long pages = 0, resident = 0;
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL)
+		return 0;
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(statm);
+	return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+#else
+	return 0;
+#endif
+}
+
+// Whether two frame tables hold the same bits
+inline bool same_frames(const FrameTable& a, const FrameTable& b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z && a.qx == b.qx && a.qy == b.qy && a.qz == b.qz && a.qw == b.qw;
+}
+
+// The old ride advancement, kept as a reference: step s by 0.001 until the distance covers velocity * deltaTime
+inline float legacy_track_step(Track& track, float s, float velocity, float deltaTime)
+{
+	float passed_time = 0.0f;
+	glm::vec3 currentPos = track.get_point(s);
+	while (passed_time < deltaTime) {
+		s += 0.001f;
+		if (s >= float(track.controlPoints.size()) + 2.0)
+			s = 2.0;
+		glm::vec3 nextPos = track.get_point(s);
+		passed_time += glm::distance(currentPos, nextPos) / velocity;
+		currentPos = nextPos;
+	}
+	return s;
+}
+
+// The old segment loader, kept as a reference: reopen and fscanf every segment file each time it is used
+inline void legacy_load_spline(const std::string& folder, const std::string& trackFile, pointVector& points)
+{
+	FILE* fileSpline = fopen((folder + trackFile).c_str(), "r");
+	if (fileSpline == NULL)
+		return;
+	int nSegments = 0;
+	fscanf(fileSpline, "%d", &nSegments);
+	for (int j = 0; j < nSegments; j++) {
+		char segmentfilename[1024];
+		if (fscanf(fileSpline, "%1023s", segmentfilename) != 1)
+			break;
+		FILE* fileSplineSegment = fopen((folder + segmentfilename).c_str(), "r");
+		if (fileSplineSegment == NULL)
+			continue;
+		int iLength;
+		fscanf(fileSplineSegment, "%d", &iLength);
+		glm::vec3 pt;
+		while (fscanf(fileSplineSegment, "%f %f %f", &pt.x, &pt.y, &pt.z) != EOF)
+			points.push_back(pt);
+		fclose(fileSplineSegment);
+	}
+	fclose(fileSpline);
+}
+
+// The old heightmap mesh, kept as a reference: push back every vertex, then add each triangle's normal into its corners
+inline void legacy_heightmap_mesh(const unsigned char* data, int width, int height, int nrChannels, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+{
+	for (int x = 0; x < width; x++) {
+		for (int y = 0; y < height; y++) {
+			Vertex v;
+			v.Position = glm::vec3(2.0f * (float(x) / float(width - 1)) - 1.0f, float(data[(x * width + y) * nrChannels]) / 255.0f, 2.0f * (float(y) / float(height - 1)) - 1.0f);
+			v.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+			v.TexCoords = glm::vec2(float(x) / float(width - 1), float(y) / float(height - 1));
+			vertices.push_back(v);
+		}
+	}
+	auto add_normal = [&](unsigned int a, unsigned int b, unsigned int c) {
+		glm::vec3 normal = glm::cross(vertices[b].Position - vertices[a].Position, vertices[c].Position - vertices[a].Position);
+		vertices[a].Normal += normal;
+		vertices[b].Normal += normal;
+		vertices[c].Normal += normal;
+	};
+	for (int x = 0; x < width - 1; x++) {
+		for (int y = 0; y < height - 1; y++) {
+			unsigned int a = x * width + y, b = a + 1, c = (x + 1) * width + y, d = c + 1;
+			indices.push_back(a);
+			indices.push_back(b);
+			indices.push_back(c);
+			add_normal(a, b, c);
+			indices.push_back(b);
+			indices.push_back(d);
+			indices.push_back(c);
+			add_normal(b, d, c);
+		}
+	}
+}
+
+// Loading a synthetic track of 100k segment references, built by repeating the parts of trackFile,
+//   with the old loader against the cached loader with its own number parser
+inline void benchmark_spline_loader(const std::string& folder, const std::string& trackFile)
+{
+	const int references = 100000;
+
+	std::vector<std::string> parts;
+	FILE* source = fopen((folder + trackFile).c_str(), "r");
+	if (source == NULL)
+		return;
+	int nParts = 0;
+	fscanf(source, "%d", &nParts);
+	char name[1024];
+	while (int(parts.size()) < nParts && fscanf(source, "%1023s", name) == 1)
+		parts.push_back(name);
+	fclose(source);
+	if (parts.empty())
+		return;
+
+	std::string syntheticFile = trackFile + ".benchmark";
+	FILE* synthetic = fopen((folder + syntheticFile).c_str(), "w");
+	if (synthetic == NULL)
+		return;
+	fprintf(synthetic, "%d\n", references);
+	for (int j = 0; j < references; j++)
+		fprintf(synthetic, "%s\n", parts[j % parts.size()].c_str());
+	fclose(synthetic);
+
+	pointVector legacyPoints;
+	auto start = std::chrono::high_resolution_clock::now();
+	legacy_load_spline(folder, syntheticFile, legacyPoints);
+	double legacy = seconds_since(start);
+
+	rc_Spline spline;
+	spline.folder = folder;
+	start = std::chrono::high_resolution_clock::now();
+	spline.loadSplineFrom(syntheticFile);
+	double cached = seconds_since(start);
+	std::remove((folder + syntheticFile).c_str());
+
+	bool same = legacyPoints.size() == spline.points().size() &&
+		std::memcmp(legacyPoints.data(), spline.points().data(), legacyPoints.size() * sizeof(glm::vec3)) == 0;
+	std::printf("Spline loader (%d segment references to %zu parts, %zu points)\n", references, parts.size(), spline.points().size());
+	std::printf("\tfscanf per use %8.03f ms\n", 1e3 * legacy);
+	std::printf("\tcached parts   %8.03f ms\t(%.01fx faster, %s points)\n\n", 1e3 * cached, legacy / cached, same ? "same" : "DIFFERENT");
+}
+
+// Opening the loaded track from text against from a compiled track file with its frames
+//   Text means parsing the parts, adding up the points and building the frames, binary means mapping the file and copying the arrays out
+inline void benchmark_track_file(Track& track, const std::string& trackFile)
+{
+	std::string binaryFile = trackFile + ".benchmark.spb";
+	if (!track.save_binary(binaryFile.c_str()))
+		return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	rc_Spline spline;
+	spline.folder = track.g_Track.folder;
+	spline.loadSplineFrom(trackFile);
+	std::vector<glm::vec3> controlPoints;
+	glm::vec3 currentpos = glm::vec3(0.0f, 0.0f, 0.0f);
+	for (pointVectorIter ptsiter = spline.points().begin(); ptsiter != spline.points().end(); ptsiter++) {
+		currentpos += *ptsiter;
+		controlPoints.push_back(currentpos);
+	}
+	SplineSamples samples;
+	track.sample_segments(track.segmentSamples, samples);
+	std::vector<Orientation> frames;
+	Track::create_frames(samples, track.frameTable.size(), track.frameTable.get(track.frameTable.size() - 1), frames);
+	double text = seconds_since(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	std::vector<glm::vec3> mappedPoints;
+	FrameTable mappedFrames;
+	std::vector<ArcLengthSample> mappedTable;
+	size_t bytes = 0;
+	{
+		MappedFile file(track.g_Track.folder + binaryFile);
+		TrackFileView view;
+		if (read_track_file(file, view)) {
+			const glm::vec3* points = (const glm::vec3*)view.controlPoints;
+			mappedPoints.assign(points, points + view.header->nControlPoints);
+			size_t n = view.header->nSamples;
+			std::vector<float>* columns[TRACK_FILE_FRAME_ARRAYS] = { &mappedFrames.x, &mappedFrames.y, &mappedFrames.z,
+				&mappedFrames.qx, &mappedFrames.qy, &mappedFrames.qz, &mappedFrames.qw };
+			for (int c = 0; c < TRACK_FILE_FRAME_ARRAYS; c++)
+				columns[c]->assign(view.frames + c * n, view.frames + (c + 1) * n);
+			const ArcLengthSample* table = (const ArcLengthSample*)view.arcLength;
+			mappedTable.assign(table, table + view.header->nArcLength);
+		}
+		bytes = file.size;
+	}
+	double binary = seconds_since(start);
+	std::remove((track.g_Track.folder + binaryFile).c_str());
+
+	bool same = same_frames(mappedFrames, track.frameTable);
+	std::printf("Track file (%zu control points, %zu frames, %.02f MB compiled)\n", track.controlPoints.size(), track.frameTable.size(), double(bytes) / (1 << 20));
+	std::printf("\ttext + frames  %8.03f ms\t(arc length table not included)\n", 1e3 * text);
+	std::printf("\tmapped         %8.03f ms\t(%.01fx faster, %s frames)\n\n", 1e3 * binary, text / binary, same ? "same" : "DIFFERENT");
+}
+
+// Cost per frame of moving along the track, stepping loop vs arc length table, at several ride speeds
+inline void benchmark_track_movement(Track& track)
+{
+	const int frames = 2000;
+	const float deltaTime = 1.0f / 60.0f;
+	const float speeds[] = { 1.0f, 5.0f, 20.0f, 80.0f };
+
+	std::printf("Track movement (%d frames at 60 fps, track length %.02f)\n", frames, track.trackLength);
+	for (float velocity : speeds) {
+		auto start = std::chrono::high_resolution_clock::now();
+		float s = 2.0f;
+		for (int i = 0; i < frames; i++)
+			s = legacy_track_step(track, s, velocity, deltaTime);
+		double legacy = seconds_since(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		float distance = 0.0f;
+		float sTable = 2.0f;
+		float height = 0.0f;
+		for (int i = 0; i < frames; i++) {
+			distance = fmod(distance + velocity * deltaTime, track.trackLength);
+			sTable = track.get_param(distance);
+			height += track.get_point(sTable).y;
+		}
+		double table = seconds_since(start);
+
+		std::printf("\tspeed %5.01f: stepping %8.03f us/frame\tarc length table %8.03f us/frame\t(end s %.03f vs %.03f, avg height %.02f)\n",
+			velocity, 1e6 * legacy / frames, 1e6 * table / frames, s, sTable, height / frames);
+	}
+	std::printf("\n");
+}
+
+// Cost of the rider pose between two frames: the old blend of three axes, renormalised and turned into the car
+//   rotation through lookAt and an inverse, against one nlerp of the quaternion table and a mat4_cast
+inline void benchmark_frame_blend(Track& track)
+{
+	const int poses = 1 << 20;
+	int n = track.frameTable.size();
+	std::vector<Orientation> frames;
+	track.frameTable.get_all(frames);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	glm::mat4 axisSum(0.0f);
+	for (int i = 0; i < poses; i++) {
+		float frame = float(n) * float(i) / float(poses);
+		int index = int(frame);
+		float blend = frame - float(index);
+		const Orientation& a = frames[index];
+		const Orientation& b = frames[(index + 1) % n];
+		glm::vec3 origin = a.origin * (1.0f - blend) + b.origin * blend;
+		glm::vec3 front = glm::normalize(a.Front * (1.0f - blend) + b.Front * blend);
+		glm::vec3 up = glm::normalize(a.Up * (1.0f - blend) + b.Up * blend);
+		axisSum += glm::inverse(glm::mat4(glm::mat3(glm::lookAt(origin, origin + front, up))));
+	}
+	double axes = seconds_since(start);
+
+	start = std::chrono::high_resolution_clock::now();
+	glm::mat4 quatSum(0.0f);
+	for (int i = 0; i < poses; i++) {
+		float frame = float(n) * float(i) / float(poses);
+		int index = int(frame);
+		glm::vec3 origin;
+		glm::quat rotation;
+		track.frameTable.blend(index, (index + 1) % n, frame - float(index), origin, rotation);
+		quatSum += glm::mat4_cast(rotation);
+	}
+	double quaternion = seconds_since(start);
+
+	float difference = 0.0f;
+	for (int c = 0; c < 3; c++)
+		difference = glm::max(difference, glm::length(glm::vec3(axisSum[c] - quatSum[c])) / float(poses));
+	std::printf("Frame blend (%d poses over %d frames)\n", poses, n);
+	std::printf("\tthree axes + lookAt  %8.03f ns/pose\t%zu bytes/frame\n", 1e9 * axes / poses, sizeof(Orientation));
+	std::printf("\tquaternion nlerp     %8.03f ns/pose\t%zu bytes/frame\t(%.01fx faster, mean car axis difference %.06f)\n\n",
+		1e9 * quaternion / poses, track.frameTable.bytes() / glm::max(n, 1), axes / quaternion, difference);
+}
+
+// The old ride step, kept as a reference: scan every frame for the highest point, then move by the speed times the frame time
+inline float legacy_ride_step(Track& track, float distance, float deltaTime)
+{
+	float hmax = 0.0f;
+	for (size_t i = 0; i < track.frameTable.size(); i++)
+		hmax = glm::max(hmax, track.frameTable.y[i]);
+	float h = track.get_point(track.get_param(distance)).y;
+	float velocity = sqrt(glm::max(2.0f * 2.0f * (hmax + 0.5f - h), 0.0f));
+	return fmod(distance + velocity * deltaTime, track.trackLength);
+}
+
+// A minute of riding at a steady 60 fps against the same minute with random hitches of up to a quarter second
+//   The variable step ride ends somewhere else depending on the frame times, the fixed step ride does not
+inline void benchmark_ride(Track& track)
+{
+	const float minute = 60.0f;
+	std::vector<float> steady(int(minute * 60.0f), 1.0f / 60.0f);
+	std::vector<float> hitchy;
+	unsigned int seed = 1;
+	float total = 0.0f;
+	while (total < minute) {
+		seed = seed * 1664525u + 1013904223u;
+		float frame = (seed >> 8) % 5 == 0 ? 0.25f * float((seed >> 12) % 1000) / 1000.0f : 1.0f / 60.0f;
+		frame = glm::min(frame, minute - total);
+		hitchy.push_back(frame);
+		total += frame;
+	}
+
+	auto legacy = [&](const std::vector<float>& frames, double& time) {
+		auto start = std::chrono::high_resolution_clock::now();
+		float distance = 0.0f;
+		for (float frame : frames)
+			distance = legacy_ride_step(track, distance, frame);
+		time = seconds_since(start);
+		return distance;
+	};
+	auto fixed = [&](const std::vector<float>& frames, double& time) {
+		Ride ride(track);
+		auto start = std::chrono::high_resolution_clock::now();
+		float distance = 0.0f;
+		for (float frame : frames) {
+			ride.advance(frame);
+			distance = ride.state().distance;
+		}
+		time = seconds_since(start);
+		return distance;
+	};
+
+	double legacySteady, legacyHitchy, fixedSteady, fixedHitchy;
+	float a = legacy(steady, legacySteady), b = legacy(hitchy, legacyHitchy);
+	float c = fixed(steady, fixedSteady), d = fixed(hitchy, fixedHitchy);
+	std::printf("Ride physics (%zu frames steady, %zu with hitches, %zu samples)\n", steady.size(), hitchy.size(), track.frameTable.size());
+	std::printf("\tvariable step  %8.03f us/frame\tend distance %.03f vs %.03f with hitches\n", 1e6 * legacySteady / steady.size(), a, b);
+	std::printf("\tfixed step     %8.03f us/frame\tend distance %.03f vs %.03f with hitches\n\n", 1e6 * fixedSteady / steady.size(), c, d);
+}
+
+// Car updates per second of the train system with 10k and 100k cars, fleets of 40 four car trains sharing the loaded track
+//   The reference moves each car on its own the way the ridden car used to be: look up s and the point, blend the
+//   three frame axes and turn them into a matrix with lookAt and an inverse
+inline void benchmark_trains(Track& track)
+{
+	const int trainsPerFleet = 40;
+	const int cars = 4;
+	const int steps = 60;
+	glm::mat4 carModel = glm::scale(glm::mat4(), glm::vec3(0.02f, 0.02f, 0.02f));
+
+	std::printf("Trains (%d trains of %d cars per fleet, %d steps)\n", trainsPerFleet, cars, steps);
+	for (int fleets : { 64, 640 }) {
+		TrainSystem system;
+		for (int f = 0; f < fleets; f++) {
+			TrainFleet& fleet = system.add_fleet(track);
+			for (int t = 0; t < trainsPerFleet; t++)
+				fleet.add_train(track.trackLength * (float(t) + float(f) / float(fleets)) / float(trainsPerFleet), cars, 0.35f);
+		}
+		size_t nCars = system.car_count();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int i = 0; i < steps; i++)
+			system.step();
+		double simulate = seconds_since(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		system.update_transforms(carModel);
+		double transforms = seconds_since(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		std::vector<glm::mat4> legacy(nCars);
+		for (size_t i = 0; i < nCars; i++) {
+			float s = track.get_param(system.fleets[i / (trainsPerFleet * cars)].carDistance[i % (trainsPerFleet * cars)]);
+			glm::vec3 position = track.get_point(s);
+			Orientation ori = track.get_orientation(s);
+			legacy[i] = glm::translate(glm::mat4(), position + ori.Up / 5.0f) * glm::inverse(glm::mat4(glm::mat3(glm::lookAt(position, position + ori.Front, ori.Up)))) * carModel;
+		}
+		double single = seconds_since(start);
+
+		float difference = 0.0f;
+		for (size_t i = 0; i < nCars; i++)
+			for (int c = 0; c < 4; c++)
+				difference = glm::max(difference, glm::length(glm::vec3(legacy[i][c] - system.carTransforms[i][c])));
+		std::printf("\t%7zu cars: step %8.03f ms (%6.01f M car updates/s)\ttransforms %7.03f ms\tone car at a time %7.03f ms\t(largest difference %.06f)\n",
+			nCars, 1e3 * simulate / steps, 1e-6 * double(nCars) * steps / simulate, 1e3 * transforms, 1e3 * single, difference);
+	}
+	std::printf("\n");
+}
+
+// Two seconds of a render loop taking the simulation thread's snapshots, with 10k train cars stepping on the other thread
+//   Every tenth frame stalls for 100 ms. The simulation should keep to its clock through the stalls, and taking a
+//   snapshot should never wait for a step
+inline void benchmark_simulation_thread(Track& track)
+{
+	Ride ride(track);
+	TrainSystem trains;
+	for (int f = 0; f < 64; f++) {
+		TrainFleet& fleet = trains.add_fleet(track);
+		for (int t = 0; t < 40; t++)
+			fleet.add_train(track.trackLength * (float(t) + float(f) / 64.0f) / 40.0f, 4, 0.35f);
+	}
+	glm::mat4 carModel = glm::scale(glm::mat4(), glm::vec3(0.02f, 0.02f, 0.02f));
+	std::vector<glm::mat4> transforms;
+
+	Simulation simulation(track, ride, trains);
+	simulation.start();
+	int frames = 0;
+	double slowestTake = 0.0, slowestTransforms = 0.0;
+	float backwards = 0.0f;
+	float lastDistance = 0.0f;
+	while (simulation.now() < 2.0) {
+		auto start = std::chrono::high_resolution_clock::now();
+		simulation.update();
+		RideState state = simulation.ride_state();
+		slowestTake = glm::max(slowestTake, seconds_since(start));
+		start = std::chrono::high_resolution_clock::now();
+		simulation.car_transforms(carModel, transforms);
+		slowestTransforms = glm::max(slowestTransforms, seconds_since(start));
+
+		//the ride only goes forward, apart from wrapping round the start
+		float moved = state.distance - lastDistance;
+		if (moved < 0.0f && moved > -0.5f * track.trackLength)
+			backwards = glm::max(backwards, -moved);
+		lastDistance = state.distance;
+
+		frames++;
+		std::this_thread::sleep_for(std::chrono::milliseconds(frames % 10 == 0 ? 100 : 16));
+	}
+	double elapsed = simulation.now();
+	simulation.stop();
+	long long expected = (long long)(elapsed / simulation.timeStep);
+
+	std::printf("Simulation thread (%zu train cars, %d frames in %.02f s, every tenth frame stalled 100 ms)\n", trains.car_count(), frames, elapsed);
+	std::printf("\tsteps %lld of %lld due, %lld dropped\n", (long long)simulation.steps, expected, (long long)simulation.droppedSteps);
+	std::printf("\tslowest snapshot take %.03f ms, slowest car transforms %.03f ms, largest step backwards %.06f\n\n",
+		1e3 * slowestTake, 1e3 * slowestTransforms, backwards);
+}
+
+// Building the heightmap mesh of a rolling synthetic image at 1k, 4k and 8k texels a side
+//   The old serial build is only run up to 4k, at 8k it needs more memory than the new build and the old one together
+//   Against it, all that displacing the heightmap on the GPU needs: reading the heights, and an R8 texture with the grid
+inline void benchmark_heightmap_mesh()
+{
+	unsigned int threads = glm::max(std::thread::hardware_concurrency(), 1u);
+	std::printf("Heightmap mesh (%u threads)\n", threads);
+	for (int size : { 1024, 4096, 8192 }) {
+		std::vector<unsigned char> image(size_t(size) * size);
+		for (int x = 0; x < size; x++)
+			for (int y = 0; y < size; y++)
+				image[size_t(x) * size + y] = (unsigned char)(127.5f + 127.5f * sin(float(x) * 0.013f) * cos(float(y) * 0.021f));
+
+		double legacy = 0.0;
+		float angle = 0.0f;
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		std::vector<float> heights;
+		if (size <= 4096) {
+			std::vector<Vertex> oldVertices;
+			std::vector<unsigned int> oldIndices;
+			auto start = std::chrono::high_resolution_clock::now();
+			legacy_heightmap_mesh(image.data(), size, size, 1, oldVertices, oldIndices);
+			legacy = seconds_since(start);
+
+			Heightmap::read_heights(image.data(), image.size(), 1, 1.0f / 255.0f, heights);
+			Heightmap::create_mesh(heights, size, size, threads, vertices, indices);
+			double sum = 0.0;
+			for (size_t i = 0; i < vertices.size(); i++)
+				sum += acos(glm::clamp(glm::dot(glm::normalize(oldVertices[i].Normal), vertices[i].Normal), -1.0f, 1.0f));
+			angle = float(glm::degrees(sum / double(vertices.size())));
+			if (oldIndices != indices)
+				angle = -1.0f;
+		}
+
+		//both builds start from empty buffers, sizing them is part of the cost
+		auto build = [&](unsigned int nThreads) {
+			std::vector<float>().swap(heights);
+			std::vector<Vertex>().swap(vertices);
+			std::vector<unsigned int>().swap(indices);
+			auto start = std::chrono::high_resolution_clock::now();
+			Heightmap::read_heights(image.data(), image.size(), 1, 1.0f / 255.0f, heights);
+			Heightmap::create_mesh(heights, size, size, nThreads, vertices, indices);
+			return seconds_since(start);
+		};
+		double single = build(1);
+		double parallel = build(threads);
+
+		std::vector<float>().swap(heights);
+		auto start = std::chrono::high_resolution_clock::now();
+		Heightmap::read_heights(image.data(), image.size(), 1, 1.0f / 255.0f, heights);
+		double displaced = seconds_since(start);
+		int grid = Heightmap::GRID_SIZE;
+		size_t displacedBytes = image.size() + size_t(grid + 1) * (grid + 1) * sizeof(glm::vec2) + size_t(grid) * grid * 6 * sizeof(unsigned int);
+		double meshBytes = double(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int));
+
+		if (size <= 4096)
+			std::printf("\t%5d: old %9.02f ms\t", size, 1e3 * legacy);
+		else
+			std::printf("\t%5d: old %9s   \t", size, "-");
+		std::printf("new 1 thread %8.02f ms\t%u threads %8.02f ms\t(%.02f MB)", 1e3 * single, threads, 1e3 * parallel, meshBytes / (1 << 20));
+		std::printf("\tGPU displacement %6.02f ms (%.02f MB, %.0fx less)", 1e3 * displaced, double(displacedBytes) / (1 << 20), meshBytes / displacedBytes);
+		if (size <= 4096)
+			std::printf("\tmean normal difference %.03f degrees%s", angle, angle < 0.0f ? ", DIFFERENT indices" : "");
+		std::printf("\n");
+	}
+	std::printf("\n");
+}
+
+// Tiles and triangles the terrain quadtree draws from 200 views flying low over a rolling synthetic heightmap,
+//   at 1k, 4k and 16k texels a side placed like the Heightmap mesh, against the triangles of the full mesh
+//   The heights of the 16k map alone take 1 GB
+inline void benchmark_terrain()
+{
+	const int views = 200;
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+	glm::mat4 model;
+	model = glm::translate(model, glm::vec3(0.0f, -10.0f, 0.0f));
+	model = glm::scale(model, glm::vec3(20.0f, 10.0f, 20.0f));
+
+	std::printf("Terrain quadtree (%d views circling 1 unit above the top of the terrain)\n", views);
+	for (int size : { 1024, 4096, 16384 }) {
+		std::vector<float> rowWave(size), columnWave(size);
+		for (int i = 0; i < size; i++) {
+			rowWave[i] = sin(float(i) * 13.0f / float(size));
+			columnWave[i] = cos(float(i) * 21.0f / float(size));
+		}
+		std::vector<float> heights(size_t(size) * size);
+		for (int x = 0; x < size; x++)
+			for (int y = 0; y < size; y++)
+				heights[size_t(x) * size + y] = 0.5f + 0.5f * rowWave[x] * columnWave[y];
+
+		auto start = std::chrono::high_resolution_clock::now();
+		Terrain terrain(heights.data(), size, size, model);
+		double build = seconds_since(start);
+
+		long long tiles = 0, culled = 0, triangles = 0, most = 0;
+		double time = 0.0;
+		for (int i = 0; i < views; i++) {
+			float angle = 2.0f * glm::pi<float>() * float(i) / float(views);
+			glm::vec3 eye(12.0f * cos(angle), 1.0f, 12.0f * sin(angle));
+			glm::vec3 ahead(-sin(angle), -0.2f, cos(angle));
+			glm::mat4 view = glm::lookAt(eye, eye + ahead, glm::vec3(0.0f, 1.0f, 0.0f));
+
+			start = std::chrono::high_resolution_clock::now();
+			terrain.select(projection, view);
+			time += seconds_since(start);
+
+			tiles += terrain.visibleTiles;
+			culled += terrain.culledTiles;
+			triangles += terrain.visibleTriangles;
+			most = glm::max(most, terrain.visibleTriangles);
+		}
+		std::printf("\t%5d: %zu nodes in %d levels built in %.01f ms\t%.01f tiles drawn, %.01f culled per view\t"
+			"%.0f triangles per view (most %lld) of %lld in the full mesh\t%.03f us per select\n",
+			size, terrain.nodes.size(), terrain.levels, 1e3 * build, double(tiles) / views, double(culled) / views,
+			double(triangles) / views, most, 2LL * (size - 1) * (size - 1), 1e6 * time / views);
+		terrain.delete_buffers();
+	}
+	std::printf("\n");
+}
+
+// Flying across 4k and 16k terrains streamed from 16 bit height tiles, 300 frames of 4 ms from one corner to the other
+//   The memory the stream takes is fixed when it opens, the process should not grow however far it goes
+inline void benchmark_terrain_stream()
+{
+	const int frames = 300;
+	const int tileSize = 256;
+	glm::mat4 model;
+	model = glm::translate(model, glm::vec3(0.0f, -10.0f, 0.0f));
+	model = glm::scale(model, glm::vec3(20.0f, 10.0f, 20.0f));
+	std::string path = "terrain.benchmark.rht";
+
+	std::printf("Terrain streaming (%d frames of 4 ms, tiles of %d cells)\n", frames, tileSize);
+	for (int size : { 4096, 16384 }) {
+		std::vector<float> columnWave(size);
+		for (int y = 0; y < size; y++)
+			columnWave[y] = cos(float(y) * 21.0f / float(size));
+		auto start = std::chrono::high_resolution_clock::now();
+		bool written = write_height_tiles(path, size, size, tileSize, HEIGHT_TILES_UINT16, [&](int x, float* out) {
+			float wave = sin(float(x) * 13.0f / float(size));
+			for (int y = 0; y < size; y++)
+				out[y] = 0.5f + 0.5f * wave * columnWave[y];
+		});
+		double write = seconds_since(start);
+
+		TerrainStream stream;
+		if (!written || !stream.open(path, model)) {
+			std::printf("\t%5d: could not write %s\n", size, path.c_str());
+			std::remove(path.c_str());
+			continue;
+		}
+		size_t before = resident_memory();
+		long long missing = 0, wanted = 0;
+		int most = 0;
+		double update = 0.0;
+		for (int i = 0; i < frames; i++) {
+			float t = float(i) / float(frames - 1);
+			glm::vec3 eye = glm::mix(glm::vec3(-19.0f, 0.5f, -17.0f), glm::vec3(19.0f, 0.5f, 17.0f), t);
+			start = std::chrono::high_resolution_clock::now();
+			stream.update(eye);
+			update += seconds_since(start);
+			wanted += stream.wantedTiles;
+			missing += stream.missingTiles;
+			most = glm::max(most, stream.missingTiles);
+			std::this_thread::sleep_for(std::chrono::milliseconds(4));
+		}
+		size_t after = resident_memory();
+		std::printf("\t%5d: written in %7.01f ms\tpools %.01f MB memory, %.01f MB GPU\t%lld tiles paged in (%.01f MB)\t"
+			"%.01f tiles wanted, %.02f missing per frame (most %d)\t%.03f ms per update\tprocess grew %.01f MB\n",
+			size, 1e3 * write, double(stream.cpu_bytes()) / (1 << 20), double(stream.gpu_bytes()) / (1 << 20),
+			stream.tilesLoaded.load(), double(stream.bytesLoaded.load()) / (1 << 20), double(wanted) / frames, double(missing) / frames,
+			most, 1e3 * update / frames, (double(after) - double(before)) / (1 << 20));
+		stream.close();
+		std::remove(path.c_str());
+	}
+	std::printf("\n");
+}
+
+// Ground height queries and ray casts against the heightmap, placed like the Heightmap mesh on a rolling synthetic terrain
+//   A million scattered points and a million along a line one at a time and batched, then rays checked against
+//   every triangle of a small map and timed on a 4k one: picking rays from above and rays grazing the ground
+inline void benchmark_height_queries()
+{
+	glm::mat4 model;
+	model = glm::translate(model, glm::vec3(0.0f, -10.0f, 0.0f));
+	model = glm::scale(model, glm::vec3(20.0f, 10.0f, 20.0f));
+	unsigned int seed = 1;
+	auto random = [&](float low, float high) {
+		seed = seed * 1664525u + 1013904223u;
+		return low + (high - low) * float(seed >> 8) / float(1 << 24);
+	};
+	auto rolling = [](HeightField& field, int size) {
+		field.rows = field.columns = size;
+		field.heights.resize(size_t(size) * size);
+		for (int x = 0; x < size; x++)
+			for (int y = 0; y < size; y++)
+				field.heights[size_t(x) * size + y] = 0.5f + 0.5f * sin(float(x) * 13.0f / float(size)) * cos(float(y) * 21.0f / float(size));
+		auto start = std::chrono::high_resolution_clock::now();
+		field.build_pyramid();
+		return seconds_since(start);
+	};
+
+	std::printf("Terrain height queries\n");
+	HeightField field;
+	const int size = 4096;
+	double build = rolling(field, size);
+	std::printf("\t%d x %d heights: min-max pyramid of %zu levels built in %.01f ms\n", size, size, field.pyramid.size(), 1e3 * build);
+
+	const size_t samples = 1000000;
+	std::vector<float> x(samples), z(samples), single(samples), batch(samples);
+	for (int scattered = 1; scattered >= 0; scattered--) {
+		for (size_t i = 0; i < samples; i++) {
+			x[i] = scattered ? random(-20.0f, 20.0f) : -15.0f + 30.0f * float(i) / float(samples);
+			z[i] = scattered ? random(-20.0f, 20.0f) : 5.0f - 10.0f * float(i) / float(samples);
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < samples; i++)
+			single[i] = field.height_at(model, x[i], z[i]);
+		double one = seconds_since(start);
+		start = std::chrono::high_resolution_clock::now();
+		field.heights_at(model, x.data(), z.data(), batch.data(), samples);
+		double many = seconds_since(start);
+		bool same = std::memcmp(single.data(), batch.data(), samples * sizeof(float)) == 0;
+		std::printf("\t%s points: %.01f M samples/s one at a time\t%.01f M samples/s batched\t%s\n",
+			scattered ? "scattered" : "coherent ", 1e-6 * samples / one, 1e-6 * samples / many, same ? "same heights" : "HEIGHTS DIFFER");
+	}
+
+	//every ray against every triangle of the mesh, in world space
+	HeightField small;
+	const int smallSize = 96;
+	rolling(small, smallSize);
+	const int checked = 500;
+	int hits = 0, wrong = 0;
+	for (int r = 0; r < checked; r++) {
+		glm::vec3 origin(random(-25.0f, 25.0f), random(-2.0f, 8.0f), random(-25.0f, 25.0f));
+		glm::vec3 direction(random(-1.0f, 1.0f), random(-1.0f, 0.2f), random(-1.0f, 1.0f));
+		float best = FLT_MAX;
+		auto corner = [&](int i, int j) {
+			glm::vec3 local(2.0f * float(i) / float(smallSize - 1) - 1.0f, small.heights[size_t(i) * smallSize + j], 2.0f * float(j) / float(smallSize - 1) - 1.0f);
+			return glm::vec3(model * glm::vec4(local, 1.0f));
+		};
+		for (int i = 0; i < smallSize - 1; i++) {
+			for (int j = 0; j < smallSize - 1; j++) {
+				glm::vec3 a = corner(i, j), b = corner(i, j + 1), c = corner(i + 1, j), d = corner(i + 1, j + 1);
+				float t;
+				if (HeightField::intersect_triangle(origin, direction, a, b, c, t) && t < best)
+					best = t;
+				if (HeightField::intersect_triangle(origin, direction, b, d, c, t) && t < best)
+					best = t;
+			}
+		}
+		float distance = FLT_MAX;
+		bool hit = small.intersect_ray(model, origin, direction, distance);
+		if (hit != (best < FLT_MAX) || (hit && fabs(distance - best) > 1e-3f * glm::max(1.0f, best)))
+			wrong++;
+		hits += hit;
+	}
+	std::printf("\t%d rays against all %d triangles of a %d x %d map: %d hit, %d differ\n",
+		checked, 2 * (smallSize - 1) * (smallSize - 1), smallSize, smallSize, hits, wrong);
+
+	const int rays = 100000;
+	for (int grazing = 0; grazing < 2; grazing++) {
+		std::vector<glm::vec3> origins(rays), directions(rays);
+		for (int r = 0; r < rays; r++) {
+			if (grazing) {
+				//a metre or so above the ground heading off almost level
+				float ox = random(-18.0f, 18.0f), oz = random(-18.0f, 18.0f);
+				origins[r] = glm::vec3(ox, field.height_at(model, ox, oz) + random(0.1f, 1.0f), oz);
+				float angle = random(0.0f, glm::two_pi<float>());
+				directions[r] = glm::vec3(cos(angle), random(-0.05f, 0.0f), sin(angle));
+			}
+			else {
+				//through the screen from a camera above the terrain
+				origins[r] = glm::vec3(random(-5.0f, 5.0f), 5.0f, random(-5.0f, 5.0f));
+				directions[r] = glm::vec3(random(-1.0f, 1.0f), random(-1.0f, -0.3f), random(-1.0f, 1.0f));
+			}
+		}
+		hits = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int r = 0; r < rays; r++) {
+			float distance;
+			hits += field.intersect_ray(model, origins[r], directions[r], distance);
+		}
+		double time = seconds_since(start);
+		std::printf("\t%s rays on %d x %d: %.02f M rays/s, %d of %d hit\n",
+			grazing ? "grazing" : "picking", size, size, 1e-6 * rays / time, hits, rays);
+	}
+	std::printf("\n");
+}
+
+// Cost per sample of the batch sampler kernels against evaluating one point at a time
+inline void benchmark_spline_sampler(Track& track)
+{
+	const int count = 1 << 21;
+	int n = track.controlPoints.size();
+	float sBegin = 2.0f;
+	float sEnd = float(n) + 2.0f;
+	float step = (sEnd - sBegin) / float(count);
+
+	std::printf("Spline sampling (%d samples over %d segments, %s by default)\n", count, n, spline_kernel_name(best_spline_kernel()));
+
+	// one point at a time through the matrix form
+	auto start = std::chrono::high_resolution_clock::now();
+	float checksum = 0.0f;
+	for (int i = 0; i < count; i++) {
+		float s = sBegin + float(i) * step;
+		int pA = int(floor(s)) - 2;
+		float u = s - floor(s);
+		glm::vec3 p = track.interpolate(track.controlPoints[pA % n], track.controlPoints[(pA + 1) % n],
+			track.controlPoints[(pA + 2) % n], track.controlPoints[(pA + 3) % n], 0.5f, u);
+		checksum += p.y;
+	}
+	double matrix = seconds_since(start);
+	std::printf("\tinterpolate      %7.03f ns/sample\t(checksum %.01f)\n", 1e9 * matrix / count, checksum);
+
+	// one point at a time through the precomputed coefficients
+	start = std::chrono::high_resolution_clock::now();
+	checksum = 0.0f;
+	for (int i = 0; i < count; i++)
+		checksum += track.get_point(sBegin + float(i) * step).y;
+	double horner = seconds_since(start);
+	std::printf("\tget_point        %7.03f ns/sample\t(checksum %.01f)\n", 1e9 * horner / count, checksum);
+
+	// batches into an already touched buffer, compared against the scalar kernel
+	SplineSamples reference, samples;
+	track.sample(sBegin, sEnd, count, reference, SPLINE_KERNEL_SCALAR);
+	track.sample(sBegin, sEnd, count, samples, SPLINE_KERNEL_SCALAR);
+	const SplineKernel kernels[] = { SPLINE_KERNEL_SCALAR, SPLINE_KERNEL_SSE, SPLINE_KERNEL_AVX2 };
+	for (SplineKernel kernel : kernels) {
+		if (kernel == SPLINE_KERNEL_AVX2 && widest_spline_kernel() != SPLINE_KERNEL_AVX2)
+			continue;
+		start = std::chrono::high_resolution_clock::now();
+		track.sample(sBegin, sEnd, count, samples, kernel);
+		double batch = seconds_since(start);
+
+		float maxError = 0.0f;
+		for (int i = 0; i < count; i++) {
+			maxError = glm::max(maxError, std::fabs(samples.px[i] - reference.px[i]));
+			maxError = glm::max(maxError, std::fabs(samples.ty[i] - reference.ty[i]));
+		}
+		std::printf("\tsample (%-6s)  %7.03f ns/sample\t(max difference from scalar %g)\n", spline_kernel_name(kernel), 1e9 * batch / count, maxError);
+	}
+	std::printf("\n");
+}
+
+// Startup cost of the track mesh on a resampled multi-million sample track, one thread against several
+inline void benchmark_mesh_generation(Track& track)
+{
+	const int count = 1 << 20;
+	int n = track.controlPoints.size();
+	glm::vec3 railOffset = glm::vec3(0.02f, 0.02f, 0.02f);
+
+	std::printf("Track mesh generation (%d samples, %u hardware threads)\n", count, std::thread::hardware_concurrency());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	SplineSamples samples;
+	track.sample(2.0f, float(n) + 2.0f, count, samples);
+	std::vector<Orientation> frames;
+	track.create_frames(samples, count, track.frameTable.get(track.frameTable.size() - 1), frames);
+	std::vector<float> params(count);
+	for (int i = 0; i < count; i++)
+		params[i] = 2.0f + float(i) * float(n) / float(count);
+	std::printf("\tsample + frames   %8.03f ms\n", 1e3 * seconds_since(start));
+
+	// the reference build also touches every page of the output so the timed runs only measure the mesh
+	std::vector<Vertex> reference, vertices;
+	std::vector<unsigned int> referenceIndices, indices;
+	Track::create_rail_mesh(frames, params, railOffset, 1, reference, referenceIndices);
+	Track::create_rail_mesh(frames, params, railOffset, 1, vertices, indices);
+
+	double single = 0.0;
+	unsigned int threads[] = { 1, 2, 4, 8, std::thread::hardware_concurrency() };
+	for (unsigned int nThreads : threads) {
+		start = std::chrono::high_resolution_clock::now();
+		Track::create_rail_mesh(frames, params, railOffset, nThreads, vertices, indices);
+		double parallel = seconds_since(start);
+		if (nThreads == 1)
+			single = parallel;
+
+		bool same = vertices.size() == reference.size() && indices == referenceIndices &&
+			std::memcmp(vertices.data(), reference.data(), vertices.size() * sizeof(Vertex)) == 0;
+		std::printf("\trail mesh %2u threads %8.03f ms\t(speedup %.02fx, %s)\n",
+			nThreads, 1e3 * parallel, single / parallel, same ? "identical" : "DIFFERENT");
+	}
+	std::printf("\n");
+}
+
+// CPU time and upload size of the rail mesh against packing only the frames for GPU extrusion
+inline void benchmark_gpu_extrusion(Track& track)
+{
+	const int count = 1 << 20;
+	int n = track.controlPoints.size();
+	glm::vec3 railOffset = glm::vec3(0.02f, 0.02f, 0.02f);
+
+	SplineSamples samples;
+	track.sample(2.0f, float(n) + 2.0f, count, samples);
+	std::vector<Orientation> frames;
+	track.create_frames(samples, count, track.frameTable.get(track.frameTable.size() - 1), frames);
+	std::vector<float> params(count);
+	for (int i = 0; i < count; i++)
+		params[i] = 2.0f + float(i) * float(n) / float(count);
+
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec4> texels;
+	FrameTable table;
+	table.assign(frames);
+	Track::create_rail_mesh(frames, params, railOffset, 1, vertices, indices);
+	Track::pack_frames(table, params, texels);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Track::create_rail_mesh(frames, params, railOffset, 1, vertices, indices);
+	double mesh = seconds_since(start);
+	start = std::chrono::high_resolution_clock::now();
+	Track::pack_frames(table, params, texels);
+	double pack = seconds_since(start);
+
+	//the extruding shaders take their topology from gl_VertexID, so the frames are all there is to upload
+	double meshBytes = double(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(unsigned int));
+	double frameBytes = double(texels.size() * sizeof(glm::vec4));
+	std::printf("GPU rail extrusion (%d samples)\n", count);
+	std::printf("\trail mesh      %8.03f ms %8.02f MB\t(vertices and indices)\n", 1e3 * mesh, meshBytes / (1 << 20));
+	std::printf("\tframes only    %8.03f ms %8.02f MB\t(%.01fx less to upload)\n", 1e3 * pack, frameBytes / (1 << 20), meshBytes / frameBytes);
+	std::printf("\tties           %zu x %zu B transforms against %zu x %zu B frame positions\n\n",
+		track.tieTransforms.size(), sizeof(glm::mat4), track.tieFrames.size(), sizeof(float));
+}
+
+// Largest gap between the rail centre line and the curve, checked halfway between samples
+inline float tessellation_error(Track& track, const std::vector<int>& counts)
+{
+	float maxError = 0.0f;
+	for (int k = 0; k < int(counts.size()); k++) {
+		float s0 = float(k) + 2.0f;
+		for (int j = 0; j < counts[k]; j++) {
+			glm::vec3 p0 = track.get_point(s0 + float(j) / float(counts[k]));
+			glm::vec3 p1 = track.get_point(s0 + float(j + 1) / float(counts[k]));
+			glm::vec3 middle = track.get_point(s0 + (float(j) + 0.5f) / float(counts[k]));
+			maxError = glm::max(maxError, glm::distance(middle, 0.5f * (p0 + p1)));
+		}
+	}
+	return maxError;
+}
+
+// Rail triangles and worst error of the fixed 0.1 step against adaptive tessellation at a few tolerances
+inline void benchmark_tessellation(Track& track)
+{
+	std::vector<int> counts;
+	auto report = [&](const char* name, const TrackParameters& settings) {
+		track.choose_subdivisions(settings, counts);
+		int samples = 0, busiest = 0;
+		for (int count : counts) {
+			samples += count;
+			busiest = glm::max(busiest, count);
+		}
+		std::printf("\t%-18s %7d samples %8d rail triangles\t(max per segment %2d, max error %.05f)\n",
+			name, samples, samples * RAIL_SEGMENT_INDICES / 3, busiest, tessellation_error(track, counts));
+	};
+
+	std::printf("Track tessellation (%zu segments)\n", track.segments.size());
+	TrackParameters settings;
+	report("fixed", settings);
+	settings.adaptive = true;
+	const float tolerances[] = { 0.0013f, 0.001f, 0.0005f };
+	for (float tolerance : tolerances) {
+		settings.tolerance = tolerance;
+		char name[32];
+		std::snprintf(name, sizeof(name), "adaptive %.04f", tolerance);
+		report(name, settings);
+	}
+	std::printf("\n");
+}
+
+// Chunks and triangles left after frustum culling and level of detail, riding along the track looking forward
+inline void benchmark_culling(Track& track)
+{
+	const int views = 200;
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+
+	long long visible = 0, culled = 0, triangles = 0;
+	long long lodChunks[TRACK_LOD_LEVELS] = {};
+	int allTriangles = track.frameTable.size() * RAIL_SEGMENT_INDICES / 3 + track.tieTransforms.size() * TIE_INDICES / 3;
+	double time = 0.0;
+	for (int i = 0; i < views; i++) {
+		Orientation ori = track.get_orientation(track.get_param(track.trackLength * float(i) / float(views)));
+		glm::vec3 eye = ori.origin + ori.Up * 0.3f;
+		glm::mat4 view = glm::lookAt(eye, eye + ori.Front, ori.Up);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		track.cull(projection, view);
+		time += seconds_since(start);
+
+		visible += track.visibleChunks;
+		culled += track.culledChunks;
+		triangles += track.visibleTriangles;
+		for (int level = 0; level < TRACK_LOD_LEVELS; level++)
+			lodChunks[level] += track.lodChunks[level];
+	}
+	std::printf("Track culling (%zu chunks of %d samples, %d views along the ride)\n", track.chunks.size(), track.parameters.chunkSamples, views);
+	std::printf("\t%.01f visible, %.01f culled chunks per view\t%.0f of %d triangles drawn (%.01f%%)\t%.03f us per cull\n",
+		double(visible) / views, double(culled) / views, double(triangles) / views, allTriangles,
+		100.0 * double(triangles) / views / allTriangles, 1e6 * time / views);
+	std::printf("\tchunks per view at each level of detail:");
+	for (int level = 0; level < TRACK_LOD_LEVELS; level++)
+		std::printf(" %.01f", double(lodChunks[level]) / views);
+	std::printf("\n\n");
+}
+
+// Cost of nudging single control points against building the whole track again
+//   Every point is put back after its move, which leaves the track as it was loaded
+inline void benchmark_track_editing(Track& track)
+{
+	const int moves = 200;
+	int n = track.controlPoints.size();
+	unsigned int seed = 1;
+	double total = 0.0, worst = 0.0;
+	size_t uploaded = 0;
+	for (int m = 0; m < moves; m++) {
+		seed = seed * 1664525u + 1013904223u;
+		int i = int(seed >> 8) % n;
+		glm::vec3 original = track.controlPoints[i];
+		glm::vec3 nudge(float(seed & 0xff) / 255.0f - 0.5f, float((seed >> 8) & 0xff) / 255.0f - 0.5f, float((seed >> 16) & 0xff) / 255.0f - 0.5f);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		track.moveControlPoint(i, original + 0.2f * nudge);
+		double elapsed = seconds_since(start);
+		total += elapsed;
+		worst = glm::max(worst, elapsed);
+		uploaded += track.editUploadBytes;
+
+		track.moveControlPoint(i, original);
+	}
+
+	size_t fullBytes = track.railIndices.size() * sizeof(unsigned int) + (track.parameters.gpuExtrusion ?
+		track.frameTexels.size() * sizeof(glm::vec4) + track.tieFrames.size() * sizeof(float) :
+		track.railVertices.size() * sizeof(Vertex) + track.tieTransforms.size() * sizeof(glm::mat4));
+	auto start = std::chrono::high_resolution_clock::now();
+	track.rebuild();
+	double rebuild = seconds_since(start);
+
+	std::printf("Track editing (%d control points, %zu samples, %d moves)\n", n, track.frameTable.size(), moves);
+	std::printf("\tmove point     %8.03f ms avg %8.03f ms max %10.02f KB uploaded avg\n", 1e3 * total / moves, 1e3 * worst, double(uploaded) / moves / 1024.0);
+	std::printf("\tfull rebuild   %8.03f ms %10.02f KB uploaded\n\n", 1e3 * rebuild, double(fullBytes) / 1024.0);
+}
+
+// Start up time of a track without its mesh cache (building it and writing the cache) and with it
+inline void benchmark_mesh_cache(const std::string& folder, const std::string& trackFile, TrackParameters parameters)
+{
+	parameters.meshCache = true;
+	std::string cacheFile = folder + trackFile + ".meshcache";
+	std::remove(cacheFile.c_str());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Track cold(trackFile.c_str(), parameters);
+	double coldTime = seconds_since(start);
+	cold.delete_buffers();
+
+	start = std::chrono::high_resolution_clock::now();
+	Track warm(trackFile.c_str(), parameters);
+	double warmTime = seconds_since(start);
+	warm.delete_buffers();
+
+	size_t bytes = 0;
+	{
+		MappedFile file(cacheFile);
+		bytes = file.size;
+	}
+	bool same = cold.railIndices == warm.railIndices && cold.tieParams == warm.tieParams && same_frames(cold.frameTable, warm.frameTable);
+	std::printf("Mesh cache (%s, %zu samples, %.02f MB cached)\n", trackFile.c_str(), cold.frameTable.size(), double(bytes) / (1 << 20));
+	std::printf("\tcold start     %8.03f ms\t(build and write the cache)\n", 1e3 * coldTime);
+	std::printf("\twarm start     %8.03f ms\t(%.01fx faster, %s data)\n\n", 1e3 * warmTime, coldTime / warmTime, same ? "same" : "DIFFERENT");
+}
+
+// Streaming a procedural track of nPoints control points through a sink that only counts the bytes
+//   The track coils round a 50 unit circle with hills on it, one control point a unit apart, and closes on itself
+inline void benchmark_track_streaming(long long nPoints = 1000000)
+{
+	const double radius = 50.0;
+	const double turn = glm::two_pi<double>();
+	long long loops = glm::max(1LL, (long long)(double(nPoints) / (turn * radius)));
+	auto coil = [&](long long i) {
+		double t = double(i % nPoints) / double(nPoints);
+		double angle = turn * double(loops) * t;
+		double height = 20.0 * sin(turn * t) + 2.0 * sin(turn * double(loops) * 7.0 * t);
+		return glm::vec3(float(radius * cos(angle)), float(height), float(radius * sin(angle)));
+	};
+
+	long long next = 0;
+	TrackStreamer::Source source = [&](glm::vec3* steps, size_t max) {
+		size_t count = 0;
+		for (; count < max && next < nPoints; count++, next++)
+			steps[count] = next == 0 ? coil(0) : coil(next) - coil(next - 1);
+		return count;
+	};
+	size_t bytes = 0;
+	TrackStreamer::Sink sink = [&](const TrackStreamChunk& chunk) {
+		bytes += chunk.railVertices.size() * sizeof(Vertex) + chunk.railIndices.size() * sizeof(unsigned int) + chunk.tieTransforms.size() * sizeof(glm::mat4);
+	};
+
+	TrackParameters parameters;
+	parameters.adaptive = true;
+	TrackStreamer streamer(parameters);
+	auto start = std::chrono::high_resolution_clock::now();
+	streamer.run(source, sink);
+	double elapsed = seconds_since(start);
+
+	std::printf("Track streaming (%lld control points, %lld samples, %lld ties, %lld chunks of %d points)\n",
+		streamer.controlPointCount, streamer.sampleCount, streamer.tieCount, streamer.chunkCount, streamer.windowPoints);
+	std::printf("\t%8.03f s, %.02f MB of geometry streamed out, %.02f MB working set\n\n",
+		elapsed, double(bytes) / (1 << 20), double(streamer.workingSetBytes) / (1 << 20));
+}
+
+// Run every benchmark against the loaded scene
+inline void run_benchmarks(Track& track)
+{
+	benchmark_spline_loader(track.g_Track.folder, "spline/track.sp");
+	benchmark_track_file(track, "spline/track.sp");
+	benchmark_mesh_cache(track.g_Track.folder, "spline/track.sp", track.parameters);
+	benchmark_track_movement(track);
+	benchmark_frame_blend(track);
+	benchmark_ride(track);
+	benchmark_trains(track);
+	benchmark_simulation_thread(track);
+	benchmark_spline_sampler(track);
+	benchmark_mesh_generation(track);
+	benchmark_gpu_extrusion(track);
+	benchmark_tessellation(track);
+	benchmark_culling(track);
+	benchmark_track_editing(track);
+	benchmark_track_streaming();
+	benchmark_heightmap_mesh();
+	benchmark_terrain();
+	benchmark_terrain_stream();
+	benchmark_height_queries();
+}
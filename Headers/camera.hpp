@@ -7,6 +7,7 @@
 #include <glm/gtc/quaternion.hpp>
 
 #include <heightmap.hpp>
+#include <ride.hpp>
 #include <track.hpp>
 #include <vector>
 
@@ -48,7 +49,8 @@ public:
 	float MouseSensitivity;
 	float Zoom;
 	// Track movement parameters
-	float s = 2.0f;  // Position you are on the track
+	double s = 2.0;  // Position you are on the track
+	double distance = 0.0;  // Distance travelled along the track
 	bool onTrack = true; // Whether or not you are following the track
 	bool tPressed; //bool to check if T was pressed
 	bool tCurPressed; //bool to check if T is currently press
@@ -96,73 +98,27 @@ public:
 			Position -= WorldUp * velocity;
 	}
 
-	//  Find the next camera position based on the amount of passed time, the track, and the track position s (defined in this class).  You can just use your code from the track function. 
-	void ProcessTrackMovement(float deltaTime, Track &track, GLFWwindow* window)
+	// Put the camera and the car where the ride simulation says, the physics live in Ride (ride.hpp)
+	void ProcessTrackMovement(Track &track, const RideState& ride)
 	{
-		//position variables
-		glm::vec3 cameraOffset = Up / 3.75f;
-		glm::vec3 currentPos = Position - cameraOffset;
-		glm::vec3 nextPos;
-		
-		//helper variables
-		float passed_time = 0.0f;
-		float distance = 0.0f;
-
-		//velocity equation variables
-		float velocity;
-		float g = 2.0f;    //gravity
-		float hmax = 0.0f; //find hmax by getting the highest point of the track
-		for (int hCount = 0; hCount < track.orientations.size(); hCount++) {
-			if (track.orientations[hCount].origin.y > hmax)
-				hmax = track.orientations[hCount].origin.y + 0.5f;
-		}
-		float h = currentPos.y ; //current height
-
-		velocity = sqrt(2*g*(hmax - h));
-
-		//Figure out how far along the track you go
-		while (passed_time < deltaTime) {
-
-			tCurPressed = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
-			if (!tPressed && tCurPressed) {	//toggle off rail if T is pressed
-				onTrack = false;
-				tPressed = tCurPressed;
-				return;
-			}
-			tPressed = tCurPressed;
-
-			// Increment s by a small amount
-			s += 0.001f;
-			// Prevent array out of bounds
-			if (s >= float(track.controlPoints.size()) + 2.0)
-				s = 2.0;
-
-			// Get next location
-			nextPos = track.get_point(s);
-			// Compute passed time to move that distance
-			distance = glm::distance(currentPos, nextPos);
-			passed_time += distance / velocity;
-			// Update location
-			currentPos = nextPos;
-		}
-
-		// Get amount for linear interpolation
-		int index = int(floor((s- 2.0) * 10.0f));
-		float blend = (s- 2.0) * 10.0f - float(index);
-
-		// Get orientations to blend between
-		Orientation ori_prev = track.orientations.at(index);
-		Orientation ori_next = track.orientations.at((index + 1) % track.orientations.size());
-
-		// Now actually blend the orientations
-		Front = ori_prev.Front * (1.0f - blend) + ori_next.Front * blend;
-		Up = ori_prev.Up * (1.0f - blend) + ori_next.Up * blend;
-		Right = ori_prev.Right * (1.0f - blend) + ori_next.Right * blend;
+		s = ride.s;
+		distance = ride.distance;
+		glm::vec3 currentPos = track.get_point(s);
+
+		// Blend the frames on either side of s, one nlerp gives the camera axes and the car rotation
+		glm::vec3 origin;
+		glm::quat rotation;
+		track.get_pose(s, origin, rotation);
+		glm::mat3 basis = glm::mat3_cast(rotation);
+		Right = basis[0];
+		Up = basis[1];
+		Front = -basis[2];
 
+		glm::vec3 cameraOffset = Up / 3.75f;
 		Position = currentPos + cameraOffset; //update camera position with vertical offset
-		carPosition = Position - cameraOffset + Up/5.0f;  //update car position
-		//take inverse of camera rotation for car rotation
-		carRotationMat = glm::inverse(glm::mat4(glm::mat3(glm::lookAt(Position, Position + Front, Up)))); 
+		carPosition = currentPos + Up/5.0f;  //update car position
+		//the rotation takes the view axes to the track frame, the same as the inverse of the camera rotation
+		carRotationMat = glm::mat4_cast(rotation);
 	}
 
 	// Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cfloat>
+
+// Axis aligned bounding box
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	// grow the box to hold p
+	void expand(const glm::vec3& p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+};
+
+// The six planes of a view frustum, pulled straight out of projection * view (Gribb and Hartmann)
+//   Each plane is (normal, d) with the normal pointing into the frustum
+struct Frustum {
+	glm::vec4 planes[6];
+
+	Frustum(const glm::mat4& viewProjection)
+	{
+		// glm is column major, row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; i++)
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+		planes[0] = rows[3] + rows[0];	//left
+		planes[1] = rows[3] - rows[0];	//right
+		planes[2] = rows[3] + rows[1];	//bottom
+		planes[3] = rows[3] - rows[1];	//top
+		planes[4] = rows[3] + rows[2];	//near
+		planes[5] = rows[3] - rows[2];	//far
+	}
+
+	// false only if the box is completely outside one of the planes
+	//   test the corner furthest along each plane normal, if that is behind the plane so is the whole box
+	bool intersects(const AABB& box) const
+	{
+		for (int i = 0; i < 6; i++) {
+			glm::vec3 normal = glm::vec3(planes[i]);
+			glm::vec3 corner(normal.x >= 0.0f ? box.max.x : box.min.x,
+				normal.y >= 0.0f ? box.max.y : box.min.y,
+				normal.z >= 0.0f ? box.max.z : box.min.z);
+			if (glm::dot(normal, corner) + planes[i].w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
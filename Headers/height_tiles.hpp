@@ -0,0 +1,206 @@
+#pragma once
+
+// Tiled raw heightmap files (.rht), for terrains too big to decode or hold in memory at once
+//   A header, an index with one entry per tile, then the tiles row of tiles by row of tiles. A tile holds its
+//   (tileSize + 1)^2 samples and a border of HEIGHT_TILES_BORDER samples all round, row by row: its last rows and
+//   columns repeat the first ones of the next tile and the border those of the tiles around it, so every tile can
+//   be drawn and lit on its own. Past the edge of the terrain the edge samples are repeated.
+//   Samples are 16 bit (0 to 65535 for heights 0 to 1) or float. Every tile starts on a 4096 byte boundary, so
+//   with 4 KiB pages its pages can be read from a memory mapping and dropped again without touching the next tile.
+//   Where pages are bigger neighbouring tiles share pages, and dropping one tile's pages drops some of theirs too.
+//   Everything is little-endian
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <track_file.hpp>
+
+const char HEIGHT_TILES_MAGIC[4] = { 'R', 'C', 'H', 'T' };
+const uint32_t HEIGHT_TILES_VERSION = 2;
+// written as a native integer, reads back differently on a big-endian machine
+const uint32_t HEIGHT_TILES_BYTE_ORDER = 0x01020304;
+// sample formats
+const uint32_t HEIGHT_TILES_UINT16 = 0;
+const uint32_t HEIGHT_TILES_FLOAT = 1;
+const uint64_t HEIGHT_TILES_ALIGNMENT = 4096;
+// samples around each tile from its neighbours, enough for the normals one sample either side of the tile's own
+const int HEIGHT_TILES_BORDER = 1;
+
+struct HeightTilesHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t format;
+	// samples down and across the whole terrain
+	uint32_t rows;
+	uint32_t columns;
+	// cells a side of a tile, and tiles down and across
+	uint32_t tileSize;
+	uint32_t tilesDown;
+	uint32_t tilesAcross;
+	uint32_t reserved;
+	// byte offset of the index from the start of the file
+	uint64_t indexOffset;
+};
+
+struct HeightTileEntry {
+	// byte offset of the tile from the start of the file
+	uint64_t offset;
+	// lowest and highest height in the tile
+	float minHeight;
+	float maxHeight;
+};
+
+// Samples a side of a stored tile, its own and the border
+inline size_t height_tile_side(const HeightTilesHeader& header)
+{
+	return size_t(header.tileSize) + 1 + 2 * HEIGHT_TILES_BORDER;
+}
+
+// Bytes of one tile's samples
+inline size_t height_tile_bytes(const HeightTilesHeader& header)
+{
+	size_t side = height_tile_side(header);
+	return side * side * (header.format == HEIGHT_TILES_FLOAT ? sizeof(float) : sizeof(uint16_t));
+}
+
+// Pointers into a mapped height tile file, valid while the MappedFile is
+struct HeightTilesView {
+	const HeightTilesHeader* header = nullptr;
+	const HeightTileEntry* index = nullptr;
+	const unsigned char* data = nullptr;
+
+	size_t tile_count() const { return size_t(header->tilesDown) * header->tilesAcross; }
+	const unsigned char* tile(size_t t) const { return data + index[t].offset; }
+};
+
+// Check the header, the index and that every tile lies inside the file, false means it is not a height tile file this build can read
+inline bool read_height_tiles(const MappedFile& file, HeightTilesView& view)
+{
+	if (file.size < sizeof(HeightTilesHeader))
+		return false;
+	const HeightTilesHeader* header = (const HeightTilesHeader*)file.data;
+	if (std::memcmp(header->magic, HEIGHT_TILES_MAGIC, 4) != 0 || header->version != HEIGHT_TILES_VERSION || header->byteOrder != HEIGHT_TILES_BYTE_ORDER)
+		return false;
+	if (header->format > HEIGHT_TILES_FLOAT || header->tileSize == 0 || header->rows < 2 || header->columns < 2 ||
+		uint64_t(header->tilesDown) * header->tileSize + 1 < header->rows || uint64_t(header->tilesAcross) * header->tileSize + 1 < header->columns)
+		return false;
+
+	auto inside = [&](uint64_t offset, uint64_t bytes) { return offset <= file.size && bytes <= file.size - offset; };
+	uint64_t tiles = uint64_t(header->tilesDown) * header->tilesAcross;
+	if (header->indexOffset % 16 != 0 || !inside(header->indexOffset, tiles * sizeof(HeightTileEntry)))
+		return false;
+	const HeightTileEntry* index = (const HeightTileEntry*)(file.data + header->indexOffset);
+	size_t bytes = height_tile_bytes(*header);
+	for (uint64_t t = 0; t < tiles; t++)
+		if (index[t].offset % HEIGHT_TILES_ALIGNMENT != 0 || !inside(index[t].offset, bytes))
+			return false;
+
+	view.header = header;
+	view.index = index;
+	view.data = file.data;
+	return true;
+}
+
+// Write a rows x columns terrain as height tiles of tileSize cells, heights from 0 to 1
+//   row(x, out) fills out[0] to out[columns - 1] with the heights of row x, and is called once per row in order.
+//   Only one band of the rows of one row of tiles is held at a time, so terrains much bigger than memory can be written
+template <typename RowSource>
+inline bool write_height_tiles(const std::string& path, int rows, int columns, int tileSize, uint32_t format, RowSource&& row)
+{
+	if (rows < 2 || columns < 2 || tileSize < 1)
+		return false;
+
+	HeightTilesHeader header;
+	std::memcpy(header.magic, HEIGHT_TILES_MAGIC, 4);
+	header.version = HEIGHT_TILES_VERSION;
+	header.byteOrder = HEIGHT_TILES_BYTE_ORDER;
+	header.format = format;
+	header.rows = rows;
+	header.columns = columns;
+	header.tileSize = tileSize;
+	header.tilesDown = (rows - 2) / tileSize + 1;
+	header.tilesAcross = (columns - 2) / tileSize + 1;
+	header.reserved = 0;
+	header.indexOffset = (sizeof(HeightTilesHeader) + 15) & ~uint64_t(15);
+
+	auto align = [](uint64_t offset) { return (offset + HEIGHT_TILES_ALIGNMENT - 1) & ~(HEIGHT_TILES_ALIGNMENT - 1); };
+	size_t tiles = size_t(header.tilesDown) * header.tilesAcross;
+	size_t bytes = height_tile_bytes(header);
+	uint64_t stride = align(bytes);
+	std::vector<HeightTileEntry> index(tiles);
+	uint64_t first = align(header.indexOffset + tiles * sizeof(HeightTileEntry));
+	for (size_t t = 0; t < tiles; t++)
+		index[t].offset = first + t * stride;
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	//the index is filled in once the tiles are written
+	fwrite(&header, sizeof(header), 1, file);
+	std::vector<char> padding(size_t(first - sizeof(header)), 0);
+	fwrite(padding.data(), 1, padding.size(), file);
+
+	int side = int(height_tile_side(header));
+	int overlap = side - tileSize;
+	std::vector<float> band(size_t(side) * columns);
+	std::vector<unsigned char> tile(size_t(stride), 0);
+	int lastRead = -1;
+	for (uint32_t down = 0; down < header.tilesDown; down++) {
+		//the first rows of the band are the last of the band before
+		int firstRow = down * tileSize - HEIGHT_TILES_BORDER;
+		if (down > 0)
+			std::memmove(&band[0], &band[size_t(tileSize) * columns], size_t(overlap) * columns * sizeof(float));
+		for (int i = down > 0 ? overlap : 0; i < side; i++) {
+			int x = glm::clamp(firstRow + i, 0, rows - 1);
+			float* out = &band[size_t(i) * columns];
+			if (x == lastRead)
+				std::memcpy(out, out - columns, columns * sizeof(float));
+			else {
+				row(x, out);
+				lastRead = x;
+			}
+		}
+
+		for (uint32_t across = 0; across < header.tilesAcross; across++) {
+			HeightTileEntry& entry = index[size_t(down) * header.tilesAcross + across];
+			float low = 1e30f, high = -1e30f;
+			int firstColumn = across * tileSize - HEIGHT_TILES_BORDER;
+			for (int i = 0; i < side; i++) {
+				const float* in = &band[size_t(i) * columns];
+				for (int j = 0; j < side; j++) {
+					float h = in[glm::clamp(firstColumn + j, 0, columns - 1)];
+					size_t k = size_t(i) * side + j;
+					if (format == HEIGHT_TILES_FLOAT)
+						((float*)tile.data())[k] = h;
+					else {
+						uint16_t q = uint16_t(glm::clamp(h, 0.0f, 1.0f) * 65535.0f + 0.5f);
+						((uint16_t*)tile.data())[k] = q;
+						h = float(q) / 65535.0f;
+					}
+					//the bounds only cover the samples the tile draws
+					bool own = i >= HEIGHT_TILES_BORDER && i < side - HEIGHT_TILES_BORDER && j >= HEIGHT_TILES_BORDER && j < side - HEIGHT_TILES_BORDER;
+					if (own) {
+						low = glm::min(low, h);
+						high = glm::max(high, h);
+					}
+				}
+			}
+			entry.minHeight = low;
+			entry.maxHeight = high;
+			fwrite(tile.data(), 1, tile.size(), file);
+		}
+	}
+
+	fseek(file, long(header.indexOffset), SEEK_SET);
+	fwrite(index.data(), sizeof(HeightTileEntry), index.size(), file);
+	bool ok = ferror(file) == 0;
+	ok = fclose(file) == 0 && ok;
+	return ok;
+}
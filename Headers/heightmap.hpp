@@ -5,8 +5,12 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <vector>
 #include <iostream>
+#include <thread>
 
 #include <shader.hpp>
 
@@ -23,27 +27,307 @@ struct Vertex {
 	glm::vec2 TexCoords;
 };
 
+// Heights of a grid of texels row by row, and the queries a Heightmap answers from them
+//   Queries take the model matrix that places the heightmap mesh in the world: the mesh spans -1 to 1 over the
+//   rows in x and the columns in z, and 0 to 1 up. The model may move, scale and turn the heightmap about the
+//   vertical, but not tilt it. Heights are bilinear between texels, ray casts hit the two triangles of each cell
+//   the mesh draws. Ray casts walk a min-max pyramid of the heights: level k holds the lowest and highest height
+//   of each block of 2^k x 2^k cells, level 0 is read straight from the heights
+class HeightField
+{
+public:
+	std::vector<float> heights;
+	int rows = 0, columns = 0;
+	// levels 1 and up of the pyramid, and the blocks across a row of each
+	std::vector<std::vector<glm::vec2>> pyramid;
+	std::vector<int> pyramidRows, pyramidColumns;
+
+	// Build the pyramid from the heights, call it after changing them
+	void build_pyramid()
+	{
+		pyramid.clear();
+		pyramidRows.clear();
+		pyramidColumns.clear();
+		if (rows < 2 || columns < 2)
+			return;
+		int down = rows - 1, across = columns - 1;
+		//always one level, the top holds a single block
+		for (int level = 1; level == 1 || down > 1 || across > 1; level++) {
+			int nextDown = (down + 1) / 2, nextAcross = (across + 1) / 2;
+			std::vector<glm::vec2> blocks(size_t(nextDown) * nextAcross);
+			for (int i = 0; i < nextDown; i++) {
+				for (int j = 0; j < nextAcross; j++) {
+					glm::vec2 range = block_range(level - 1, 2 * i, 2 * j);
+					for (int k = 1; k < 4; k++) {
+						int childRow = 2 * i + k / 2, childColumn = 2 * j + k % 2;
+						if (childRow < down && childColumn < across) {
+							glm::vec2 child = block_range(level - 1, childRow, childColumn);
+							range = glm::vec2(glm::min(range.x, child.x), glm::max(range.y, child.y));
+						}
+					}
+					blocks[size_t(i) * nextAcross + j] = range;
+				}
+			}
+			pyramid.push_back(std::move(blocks));
+			pyramidRows.push_back(nextDown);
+			pyramidColumns.push_back(nextAcross);
+			down = nextDown;
+			across = nextAcross;
+		}
+	}
+
+	// Bilinear height of the ground in the world at world x, z, clamped to the edge of the heightmap
+	float height_at(const glm::mat4& model, float x, float z) const
+	{
+		if (rows < 2 || columns < 2)
+			return 0.0f;
+		Placement place(model, rows, columns);
+		return sample(place, x, z);
+	}
+
+	// height_at for count points, x[i], z[i] into out[i], working out the placement once
+	void heights_at(const glm::mat4& model, const float* x, const float* z, float* out, size_t count) const
+	{
+		if (rows < 2 || columns < 2) {
+			std::fill(out, out + count, 0.0f);
+			return;
+		}
+		Placement place(model, rows, columns);
+		for (size_t i = 0; i < count; i++)
+			out[i] = sample(place, x[i], z[i]);
+	}
+
+	// Whether world x, z lies over the heightmap
+	bool contains(const glm::mat4& model, float x, float z) const
+	{
+		Placement place(model, rows, columns);
+		float row = place.rowX * x + place.rowZ * z + place.row0;
+		float column = place.columnX * x + place.columnZ * z + place.column0;
+		return row >= 0.0f && row <= float(rows - 1) && column >= 0.0f && column <= float(columns - 1);
+	}
+
+	// First hit of the ray origin + t direction with the triangles of the heightmap mesh, t in lengths of direction
+	//   Blocks of the pyramid the ray misses, or only meets beyond the nearest hit so far, are skipped whole
+	bool intersect_ray(const glm::mat4& model, const glm::vec3& origin, const glm::vec3& direction, float& distance, float maxDistance = FLT_MAX) const
+	{
+		if (pyramid.empty())
+			return false;
+
+		//the ray in grid space, x in rows, y the height and z in columns; an affine map keeps t the same
+		glm::mat4 toGrid;
+		toGrid = glm::translate(toGrid, glm::vec3(0.5f * float(rows - 1), 0.0f, 0.5f * float(columns - 1)));
+		toGrid = glm::scale(toGrid, glm::vec3(0.5f * float(rows - 1), 1.0f, 0.5f * float(columns - 1)));
+		toGrid = toGrid * glm::inverse(model);
+		glm::vec3 o = glm::vec3(toGrid * glm::vec4(origin, 1.0f));
+		glm::vec3 d = glm::vec3(toGrid * glm::vec4(direction, 0.0f));
+		glm::vec3 inverse;
+		for (int k = 0; k < 3; k++)
+			inverse[k] = 1.0f / (d[k] != 0.0f ? d[k] : 1e-30f);
+
+		//blocks as (level, row, column), the nearest child is pushed last so it comes off first
+		int stack[3 * 32 + 1][3];
+		int top = 0;
+		stack[top][0] = pyramid.size();
+		stack[top][1] = 0;
+		stack[top][2] = 0;
+		top++;
+		float best = maxDistance;
+		while (top > 0) {
+			top--;
+			int level = stack[top][0], i = stack[top][1], j = stack[top][2];
+			glm::vec2 range = block_range(level, i, j);
+			glm::vec3 low(float(i << level), range.x, float(j << level));
+			glm::vec3 high(float(glm::min((i + 1) << level, rows - 1)), range.y, float(glm::min((j + 1) << level, columns - 1)));
+			glm::vec3 t0 = (low - o) * inverse, t1 = (high - o) * inverse;
+			glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+			float enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+			float exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, best));
+			if (enter > exit)
+				continue;
+
+			if (level == 0) {
+				// the two triangles of the cell, as Heightmap::create_mesh joins them
+				glm::vec3 a(float(i), height(i, j), float(j));
+				glm::vec3 b(float(i), height(i, j + 1), float(j + 1));
+				glm::vec3 c(float(i + 1), height(i + 1, j), float(j));
+				glm::vec3 e(float(i + 1), height(i + 1, j + 1), float(j + 1));
+				float t;
+				if (intersect_triangle(o, d, a, b, c, t) && t < best)
+					best = t;
+				if (intersect_triangle(o, d, b, e, c, t) && t < best)
+					best = t;
+				continue;
+			}
+
+			//children nearest along the ray first, so a near hit culls the far ones
+			int children[4][2];
+			float entry[4];
+			int n = 0;
+			float size = float(1 << (level - 1));
+			for (int k = 0; k < 4; k++) {
+				int childRow = 2 * i + k / 2, childColumn = 2 * j + k % 2;
+				if (childRow >= level_rows(level - 1) || childColumn >= level_columns(level - 1))
+					continue;
+				entry[n] = ((float(childRow) + 0.5f) * size - o.x) * d.x + ((float(childColumn) + 0.5f) * size - o.z) * d.z;
+				children[n][0] = childRow;
+				children[n][1] = childColumn;
+				n++;
+			}
+			//the farthest goes on the stack first
+			for (int a = 0; a < n; a++) {
+				int farthest = a;
+				for (int b = a + 1; b < n; b++)
+					if (entry[b] > entry[farthest])
+						farthest = b;
+				std::swap(entry[a], entry[farthest]);
+				std::swap(children[a][0], children[farthest][0]);
+				std::swap(children[a][1], children[farthest][1]);
+				stack[top][0] = level - 1;
+				stack[top][1] = children[a][0];
+				stack[top][2] = children[a][1];
+				top++;
+			}
+		}
+		if (best >= maxDistance)
+			return false;
+		distance = best;
+		return true;
+	}
+
+	// Moller-Trumbore, t along d of the hit of ray o, d with triangle a, b, c, in front of o
+	static bool intersect_triangle(const glm::vec3& o, const glm::vec3& d, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& t)
+	{
+		glm::vec3 ab = b - a, ac = c - a;
+		glm::vec3 p = glm::cross(d, ac);
+		float det = glm::dot(ab, p);
+		if (fabs(det) < 1e-12f)
+			return false;
+		float inverse = 1.0f / det;
+		glm::vec3 s = o - a;
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, ab);
+		float v = glm::dot(d, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		t = glm::dot(ac, q) * inverse;
+		return t >= 0.0f;
+	}
+
+private:
+	// world x, z to a fractional row and column, and the world height of a height at x, z
+	struct Placement {
+		float rowX, rowZ, row0, columnX, columnZ, column0;
+		float heightScale, heightX, heightZ, height0;
+
+		Placement(const glm::mat4& model, int rows, int columns)
+		{
+			// local x, z from world x, z by the inverse of the horizontal part of the model
+			float det = model[0][0] * model[2][2] - model[2][0] * model[0][2];
+			float xx = model[2][2] / det, xz = -model[2][0] / det;
+			float zx = -model[0][2] / det, zz = model[0][0] / det;
+			float x0 = -(xx * model[3][0] + xz * model[3][2]);
+			float z0 = -(zx * model[3][0] + zz * model[3][2]);
+			// row = (local x + 1) (rows - 1) / 2, the same for columns
+			float rowScale = 0.5f * float(rows - 1), columnScale = 0.5f * float(columns - 1);
+			rowX = xx * rowScale;
+			rowZ = xz * rowScale;
+			row0 = (x0 + 1.0f) * rowScale;
+			columnX = zx * columnScale;
+			columnZ = zz * columnScale;
+			column0 = (z0 + 1.0f) * columnScale;
+			// world y = model (local x, h, local z) . y
+			heightScale = model[1][1];
+			heightX = model[0][1] * xx + model[2][1] * zx;
+			heightZ = model[0][1] * xz + model[2][1] * zz;
+			height0 = model[0][1] * x0 + model[2][1] * z0 + model[3][1];
+		}
+	};
+
+	float height(int row, int column) const
+	{
+		return heights[size_t(row) * columns + column];
+	}
+
+	float sample(const Placement& place, float x, float z) const
+	{
+		float row = glm::clamp(place.rowX * x + place.rowZ * z + place.row0, 0.0f, float(rows - 1));
+		float column = glm::clamp(place.columnX * x + place.columnZ * z + place.column0, 0.0f, float(columns - 1));
+		int i = glm::min(int(row), rows - 2), j = glm::min(int(column), columns - 2);
+		float u = row - float(i), v = column - float(j);
+		const float* p = &heights[size_t(i) * columns + j];
+		float above = p[0] + (p[1] - p[0]) * v;
+		float below = p[columns] + (p[columns + 1] - p[columns]) * v;
+		float h = above + (below - above) * u;
+		return place.heightScale * h + place.heightX * x + place.heightZ * z + place.height0;
+	}
+
+	// blocks down and across at a level
+	int level_rows(int level) const { return level > 0 ? pyramidRows[level - 1] : rows - 1; }
+	int level_columns(int level) const { return level > 0 ? pyramidColumns[level - 1] : columns - 1; }
+
+	// lowest and highest height of block i, j at a level
+	glm::vec2 block_range(int level, int i, int j) const
+	{
+		if (level > 0)
+			return pyramid[level - 1][size_t(i) * pyramidColumns[level - 1] + j];
+		float a = height(i, j), b = height(i, j + 1), c = height(i + 1, j), d = height(i + 1, j + 1);
+		return glm::vec2(glm::min(glm::min(a, b), glm::min(c, d)), glm::max(glm::max(a, b), glm::max(c, d)));
+	}
+};
+
 class Heightmap
 {
 public:
+	// places the heightmap mesh, which spans -1 to 1 across and 0 to 1 up, in the world
+	glm::mat4 model;
+	// cells a side of the grid drawn over each tile of the heightmap when it is displaced in the vertex shader
+	static const int GRID_SIZE = 64;
 
 	// constructor
-	Heightmap(const char* heightmapPath)
+	//   With meshOnCPU every texel becomes a vertex. Without it only the height texture is uploaded, and
+	//   heightmapDisplace.vert lifts one small grid, drawn once per tile, to the heights and works out the normals
+	Heightmap(const char* heightmapPath, bool meshOnCPU = true)
+	{
+		model = glm::translate(model, glm::vec3(0.0f, -10.0f, 0.0f));
+		model = glm::scale(model, glm::vec3(20.0f, 10.0f, 20.0f));
+		cpuMesh = meshOnCPU;
+
+		// Create buffers for rendering
+		setup_heightmap();
+
+		// load Heightmap data into them
+		load(heightmapPath);
+	}
+
+	/*
+	Load a heightmap image in place of the one drawn so far, reusing the buffers and the texture
+	  The height is the first channel. 8 bit images are uploaded as R8, 16 bit ones as R16 and HDR ones as R32F
+	*/
+	void load(const char* heightmapPath)
 	{
 		// load Heightmap data
 		load_heightmap(heightmapPath);
 
-		// create Heightmap verts from the data
-		create_heightmap();
+		// create Heightmap verts, normals and indices from the heights
+		if (cpuMesh) {
+			create_mesh(field.heights, rows(), columns(), std::thread::hardware_concurrency(), vertices, indices);
+			upload_mesh();
+		}
+		field.rows = rows();
+		field.columns = columns();
+		field.build_pyramid();
+		tilesDown = (glm::max(rows() - 1, 0) + GRID_SIZE - 1) / GRID_SIZE;
+		tilesAcross = (glm::max(columns() - 1, 0) + GRID_SIZE - 1) / GRID_SIZE;
+
+		// the texture is needed by the displacement shader and the terrain either way
+		if (data)
+			upload_heights();
 
 		// free image data once no longer needed
 		stbi_image_free(data);
-
-		// Now create indices
-		create_indices();
-
-		// Create buffers for rendering
-		setup_heightmap();
+		data = NULL;
 	}
 
 	// render the mesh
@@ -51,10 +335,7 @@ public:
 	{
 		// Set the shader properties
 		shader.use();
-		glm::mat4 heightmap_model;
-		heightmap_model = glm::translate(heightmap_model, glm::vec3(0.0f, -10.0f, 0.0f));
-		heightmap_model = glm::scale(heightmap_model, glm::vec3(20.0f, 10.0f, 20.0f));
-		shader.setMat4("model", heightmap_model);
+		shader.setMat4("model", model);
 
 		// Set material properties
 		shader.setVec3("material.specular", 0.3f, 0.3f, 0.3f);
@@ -65,15 +346,45 @@ public:
 		// and finally bind the textures
 		glBindTexture(GL_TEXTURE_2D, textureID);
 
-		// draw mesh using EBO
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		if (cpuMesh) {
+			// draw mesh using EBO
+			glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		}
+		else {
+			// draw the grid once per tile, the shader finds its tile from the instance
+			shader.setInt("heights", 1);
+			shader.setInt("gridSize", GRID_SIZE);
+			shader.setInt("tilesAcross", tilesAcross);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, heightTexture);
+			glDrawElementsInstanced(GL_TRIANGLES, gridIndexCount, GL_UNSIGNED_INT, 0, tilesDown * tilesAcross);
+		}
 		glBindVertexArray(0);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
+	// Height of every texel row by row, rows() rows of columns() each
+	const std::vector<float>& get_heights() const { return field.heights; }
+	int rows() const { return height; }
+	int columns() const { return width; }
+	// the heights and their min-max pyramid
+	const HeightField& get_field() const { return field; }
+
+	// Height of the ground in the world at world x, z, as drawn with model
+	float height_at(float x, float z) const { return field.height_at(model, x, z); }
+	// height_at for count points at once, the placement is only worked out once per batch
+	void heights_at(const float* x, const float* z, float* out, size_t count) const { field.heights_at(model, x, z, out, count); }
+	// First hit of a world space ray with the ground, at origin + distance direction
+	bool intersect_ray(const glm::vec3& origin, const glm::vec3& direction, float& distance, float maxDistance = FLT_MAX) const
+	{
+		return field.intersect_ray(model, origin, direction, distance, maxDistance);
+	}
+	// the heights as a single channel texture, a row of the heightmap along s
+	unsigned int get_height_texture() const { return heightTexture; }
+
 	/*
 	Perform cleanup by deleting the buffers
 	*/
@@ -82,16 +393,112 @@ public:
 		glDeleteVertexArrays(1, &VAO);
 		glDeleteBuffers(1, &VBO);
 		glDeleteBuffers(1, &EBO);
+		glDeleteTextures(1, &heightTexture);
+	}
+
+	/*
+	Heights of the first channel of an image of texels texels, times scale
+	  The first channel is also packed to the front of the image in place, ready to upload as a single channel texture
+	*/
+	template <typename T>
+	static void read_heights(T* image, size_t texels, int nrChannels, float scale, std::vector<float>& heights)
+	{
+		heights.resize(texels);
+		for (size_t i = 0; i < texels; i++) {
+			T h = image[i * nrChannels];
+			image[i] = h;
+			heights[i] = float(h) * scale;
+		}
+	}
+
+	/*
+	Build the grid mesh of rows x columns heights, one vertex per texel: x runs down the rows and z along a row
+	  Works in stripes of rows on nThreads threads. Every buffer is sized up front and each stripe only writes its own rows,
+	  the vertices and the indices of the cells below them. Normals are central differences of the neighbouring heights,
+	  gathered per vertex instead of adding each triangle into its corners
+	*/
+	static void create_mesh(const std::vector<float>& heights, int rows, int columns, unsigned int nThreads,
+		std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		if (rows < 2 || columns < 2) {
+			vertices.clear();
+			indices.clear();
+			return;
+		}
+		vertices.resize(size_t(rows) * columns);
+		indices.resize(size_t(rows - 1) * (columns - 1) * 6);
+
+		//not worth starting threads for small images
+		const int minRowsPerThread = 64;
+		if (nThreads > unsigned(rows / minRowsPerThread))
+			nThreads = rows / minRowsPerThread;
+		if (nThreads < 1)
+			nThreads = 1;
+		auto in_stripes = [&](auto&& build) {
+			std::vector<std::thread> workers;
+			for (unsigned int t = 1; t < nThreads; t++)
+				workers.emplace_back(build, int((long long)rows * t / nThreads), int((long long)rows * (t + 1) / nThreads));
+			build(0, int((long long)rows / nThreads));
+			for (std::thread& worker : workers)
+				worker.join();
+		};
+
+		// vertices with their normals, and the two triangles of every cell below them
+		float dx = 2.0f / float(rows - 1);
+		float dz = 2.0f / float(columns - 1);
+		in_stripes([&](int first, int last) {
+			for (int x = first; x < last; x++) {
+				const float* above = &heights[size_t(glm::max(x - 1, 0)) * columns];
+				const float* row = &heights[size_t(x) * columns];
+				const float* below = &heights[size_t(glm::min(x + 1, rows - 1)) * columns];
+				float stepX = float(glm::min(x + 1, rows - 1) - glm::max(x - 1, 0)) * dx;
+				Vertex* v = &vertices[size_t(x) * columns];
+				for (int y = 0; y < columns; y++) {
+					int left = glm::max(y - 1, 0), right = glm::min(y + 1, columns - 1);
+					float dhdx = (below[y] - above[y]) / stepX;
+					float dhdz = (row[right] - row[left]) / (float(right - left) * dz);
+					v[y].Position = glm::vec3(2.0f * (float(x) / float(rows - 1)) - 1.0f, row[y], 2.0f * (float(y) / float(columns - 1)) - 1.0f);
+					v[y].Normal = glm::normalize(glm::vec3(-dhdx, 1.0f, -dhdz));
+					v[y].TexCoords = glm::vec2(float(x) / float(rows - 1), float(y) / float(columns - 1));
+				}
+
+				if (x == rows - 1)
+					continue;
+				unsigned int* index = &indices[size_t(x) * (columns - 1) * 6];
+				for (int y = 0; y < columns - 1; y++) {
+					// Get indices of square "cell" in heightmap setup
+					unsigned int a = x * columns + y;
+					unsigned int b = a + 1;
+					unsigned int c = a + columns;
+					unsigned int d = c + 1;
+					index[0] = a;
+					index[1] = b;
+					index[2] = c;
+					index[3] = b;
+					index[4] = d;
+					index[5] = c;
+					index += 6;
+				}
+			}
+		});
 	}
 
 private:
 
 	// Render data
 	unsigned int VAO, VBO, EBO;
+	unsigned int heightTexture;
+	// whether the vertices are built on the CPU, otherwise the grid and its tiles over the heightmap
+	bool cpuMesh;
+	GLsizei gridIndexCount = 0;
+	int tilesDown = 0, tilesAcross = 0;
 	//Heightmap attributes
-	int width, height, nrChannels;
-	// Pointer to input data buffer
-	unsigned char* data;
+	int width = 0, height = 0, nrChannels = 0;
+	// Pointer to input data buffer, and its texture format and type
+	void* data = NULL;
+	GLenum internalFormat, dataType;
+	// Height of every texel, row by row, and the pyramid for queries
+	HeightField field;
 	// Heightmap data
 	std::vector<Vertex> vertices;
 	// indices for EBO
@@ -104,135 +511,128 @@ private:
 	void load_heightmap(const char* heightmapPath)
 	{
 		// Save number of channels to avoid problems with 8-bit vs. 24-bit vs. 32-bit images
-		data = stbi_load(heightmapPath, &width, &height, &nrChannels, 0);
+		// 16 bit and HDR images are read at their own precision
+		size_t texels = 0;
+		if (stbi_is_hdr(heightmapPath)) {
+			float* image = stbi_loadf(heightmapPath, &width, &height, &nrChannels, 0);
+			texels = size_t(width) * height;
+			if (image)
+				read_heights(image, texels, nrChannels, 1.0f, field.heights);
+			data = image;
+			internalFormat = GL_R32F;
+			dataType = GL_FLOAT;
+		}
+		else if (stbi_is_16_bit(heightmapPath)) {
+			stbi_us* image = stbi_load_16(heightmapPath, &width, &height, &nrChannels, 0);
+			texels = size_t(width) * height;
+			if (image)
+				read_heights(image, texels, nrChannels, 1.0f / 65535.0f, field.heights);
+			data = image;
+			internalFormat = GL_R16;
+			dataType = GL_UNSIGNED_SHORT;
+		}
+		else {
+			unsigned char* image = stbi_load(heightmapPath, &width, &height, &nrChannels, 0);
+			texels = size_t(width) * height;
+			if (image)
+				read_heights(image, texels, nrChannels, 1.0f / 255.0f, field.heights);
+			data = image;
+			internalFormat = GL_R8;
+			dataType = GL_UNSIGNED_BYTE;
+		}
 		if (!data)
 		{
 			std::cout << "Failed to load heightmap" << std::endl;
+			width = height = 0;
+			field.heights.clear();
 		}
 	}
 
 
 
-	/*
-	Helper function for creating individual vertices
-	*/
-	Vertex make_vertex(int img_x, int img_y)
-	{
-		Vertex v;
-		//XYZ coords
-		v.Position.x = 2.0f*(float(img_x) / float(width - 1)) - 1.0f;
-		v.Position.y = float(data[(img_x *width + img_y)*nrChannels]) / 255.0f;
-		v.Position.z = 2.0f*(float(img_y) / float(height - 1)) - 1.0f;
-
-		// Setting normal to default, calculate later.  
-		v.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
-
-		//Texture Coords
-		v.TexCoords.x = float(img_x) / float(width - 1);
-		v.TexCoords.y = float(img_y) / float(height - 1);
-		return v;
-	}
-
-
-	/*
-	Create all vertices for the heightmap by iterating 
-	Vertices made
-	*/
-	void create_heightmap()
+	void setup_heightmap()
 	{
-		// convert heightmap to floats and set texture coordinates
-		for (int x = 0; x < width; x++)
-		{
-			for (int y = 0; y < height; y++)
-			{
-				vertices.push_back(make_vertex(x, y));
-			}
+		// create buffers/arrays
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glGenTextures(1, &heightTexture);
 
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		if (cpuMesh) {
+			// the vertices are loaded into the buffers by load()
+			// set the vertex attribute pointers
+			// vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+			// vertex normal coords
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+			// vertex texture coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 		}
-	}
-
-	// Find the normal for each triangle uisng the cross product and then add it to all three vertices of the triangle.  
-	//   The normalization of all the triangles happens in the shader which averages all norms of adjacent triangles.   
-	//   Order of the triangles matters here since you want to normal facing out of the object.  
-	void set_normals(Vertex &p1, Vertex &p2, Vertex &p3)
-	{
-		glm::vec3 normal =  glm::cross(p2.Position - p1.Position, p3.Position - p1.Position);
-		p1.Normal += normal;
-		p2.Normal += normal;
-		p3.Normal += normal;
-	}
-
-	/*
-	Create all indices for the heightmap
-	*/
-	void create_indices()
-	{
-		// convert heightmap to floats and set texture coordinates.  Also set normals for each triangle we define.
-		for (int x = 0; x < width - 1; x++)
-		{
-			for (int y = 0; y < height - 1; y++)
-			{
-				// Get indices of square "cell" in heightmap setup
-				unsigned int a, b, c, d;
-				a = x*width + y;
-				b = x*width + y + 1;
-				c = (x + 1)*width + y;
-				d = (x + 1)*width + y + 1;
-
-				// Triangle 1
-				indices.push_back(a); // 0
-				indices.push_back(b); // 1
-				indices.push_back(c); // 3
-
-				//while here, add normals
-				set_normals(vertices[a], vertices[b], vertices[c]);
-
-				// Triangle 2
-				indices.push_back(b); // 1
-				indices.push_back(d); // 2
-				indices.push_back(c); // 3
-
-				//And again, add normals. 
-				set_normals(vertices[b], vertices[d], vertices[c]);
- 
+		else {
+			// one tile of grid, each vertex its (row, column) within the tile, it does not change with the heightmap
+			std::vector<glm::vec2> grid;
+			for (int x = 0; x <= GRID_SIZE; x++)
+				for (int y = 0; y <= GRID_SIZE; y++)
+					grid.push_back(glm::vec2(float(x), float(y)));
+			std::vector<unsigned int> gridIndices;
+			for (int x = 0; x < GRID_SIZE; x++) {
+				for (int y = 0; y < GRID_SIZE; y++) {
+					unsigned int a = x * (GRID_SIZE + 1) + y;
+					unsigned int b = a + 1;
+					unsigned int c = a + GRID_SIZE + 1;
+					unsigned int d = c + 1;
+					gridIndices.insert(gridIndices.end(), { a, b, c, b, d, c });
+				}
 			}
+			gridIndexCount = gridIndices.size();
 
+			glBufferData(GL_ARRAY_BUFFER, grid.size() * sizeof(glm::vec2), &grid[0], GL_STATIC_DRAW);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, gridIndices.size() * sizeof(unsigned int), &gridIndices[0], GL_STATIC_DRAW);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
 		}
+		glBindVertexArray(0);
+
+		// heights are sampled bilinearly by the terrain, and fetched texel by texel by the displacement shader
+		glBindTexture(GL_TEXTURE_2D, heightTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
 	}
-	
 
-	void setup_heightmap()
+	// Load the mesh into the buffers made by setup_heightmap
+	void upload_mesh()
 	{
-		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-
 		glBindVertexArray(VAO);
-		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/3/2 array which
 		// again translates to 3/3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.empty() ? NULL : &vertices[0], GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normal coords
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
 		glBindVertexArray(0);
 	}
 
+	// Load the packed first channel of the image into the height texture
+	void upload_heights()
+	{
+		// rows of one byte texels need not be 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_2D, heightTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RED, dataType, data);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
 };
 #endif
@@ -42,6 +42,8 @@ public:
 	vector<unsigned int> indices;
 	vector<Texture> textures;
 	unsigned int VAO;
+	// buffer the instance matrices are read from, 0 until the mesh is first drawn instanced
+	unsigned int instanceBuffer = 0;
 
 	/*  Functions  */
 	// constructor
@@ -57,6 +59,44 @@ public:
 
 	// render the mesh
 	void Draw(Shader shader)
+	{
+		bindTextures(shader);
+
+		// draw mesh
+		glBindVertexArray(VAO);
+		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// render count copies of the mesh in one draw call, the model matrix of each copy is read from buffer
+	void DrawInstanced(Shader shader, unsigned int buffer, unsigned int count)
+	{
+		if (instanceBuffer != buffer)
+			setupInstances(buffer);
+		bindTextures(shader);
+
+		// the instance attributes are only on for this draw, so a later Draw never reads the instance buffer
+		glBindVertexArray(VAO);
+		for (int column = 0; column < 4; column++)
+			glEnableVertexAttribArray(5 + column);
+		glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, count);
+		for (int column = 0; column < 4; column++)
+			glDisableVertexAttribArray(5 + column);
+		glBindVertexArray(0);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+private:
+	/*  Render data  */
+	unsigned int VBO, EBO;
+
+	/*  Functions    */
+	// bind the textures to their units and point the sampler uniforms at them
+	void bindTextures(Shader shader)
 	{
 		// bind appropriate textures
 		unsigned int diffuseNr = 1;
@@ -84,21 +124,23 @@ public:
 			// and finally bind the texture
 			glBindTexture(GL_TEXTURE_2D, textures[i].id);
 		}
+	}
 
-		// draw mesh
+	// point the instance model matrix, locations 5 to 8, at a buffer of one mat4 per instance
+	//   the attributes are left disabled, DrawInstanced turns them on around its draw call
+	void setupInstances(unsigned int buffer)
+	{
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		for (int column = 0; column < 4; column++) {
+			glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(5 + column, 1);
+		}
 		glBindVertexArray(0);
-
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		instanceBuffer = buffer;
 	}
 
-private:
-	/*  Render data  */
-	unsigned int VBO, EBO;
-
-	/*  Functions    */
 	// initializes all the buffer objects/arrays
 	void setupMesh()
 	{
@@ -43,10 +43,22 @@ public:
 	// draws the model, and thus all its meshes
 	void Draw(Shader shader)
 	{
+		shader.setBool("instanced", false);
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
+	// draws count copies of the model with one draw call per mesh, instanceBuffer holds a mat4 model matrix per copy
+	//   that is applied after the model uniform. The shader needs the instance matrix at locations 5 to 8 (lightingShader_nMap.vert)
+	void DrawInstanced(Shader shader, unsigned int instanceBuffer, unsigned int count)
+	{
+		if (count == 0)
+			return;
+		shader.setBool("instanced", true);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawInstanced(shader, instanceBuffer, count);
+	}
+
 private:
 	/*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
@@ -5,8 +5,10 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstdio>
 #include <string>
 #include <vector>
+#include <map>
 
 class rc_SplineSegment;
 class rc_Spline;
@@ -24,13 +26,80 @@ private:
 	/** @brief vector of control points */
 	pointVector m_vPoints;
 
+	/** @brief points of a segment file read before, and when it was last used */
+	struct CachedSegment
+	{
+		pointVector points;
+		unsigned long long lastUsed;
+	};
+
+	/** @brief points of the segment files read so far, by path
+	*
+	*  Tracks reuse the same few parts many times, repeats are copied from here.
+	*  While streaming only the m_segmentCacheLimit most recently used files are kept, 0 keeps every one
+	*/
+	std::map<std::string, CachedSegment> m_segmentCache;
+	size_t m_segmentCacheLimit = 0;
+	unsigned long long m_segmentUses = 0;
+
+	/** @brief track file being streamed, the segments still to read from it, and how far into m_vPoints the stream is */
+	FILE* m_stream = NULL;
+	int m_streamSegments = 0;
+	size_t m_streamNext = 0;
+
+	/** @brief block of the streamed file read so far, and how far into it the stream has parsed */
+	std::string m_streamBlock;
+	size_t m_streamParsed = 0;
+
+	/** @brief bytes read from the streamed file at a time */
+	static const size_t STREAM_BLOCK_SIZE = 1 << 16;
+
+	/** @brief next word of the streamed file, reading it a block at a time
+	*
+	*  @param word receives the characters up to the next space, tab or line break
+	*  @return false at the end of the file
+	*/
+	bool readStreamWord(std::string& word);
+
 	/** @brief load the definition of this spline segment from a file 
 	*  
 	*  @param filename file containing the definition for this spline segment
 	*/
 	void loadSegmentFrom(std::string filename);
 
+	/** @brief drop the least recently used segment files from the cache
+	*
+	*  @param keep most files left in the cache
+	*/
+	void trimSegmentCache(size_t keep);
+
+	/** @brief read a whole file into memory with a single read
+	*
+	*  @param filename path of the file
+	*  @param contents receives the bytes of the file
+	*  @return false if the file can't be opened
+	*/
+	static bool readFile(const std::string& filename, std::string& contents);
+
 public:
+	rc_Spline() {}
+
+	/** @brief closes a stream that was not read to the end */
+	~rc_Spline() { closeStream(); }
+
+	/** @brief a spline owns its open stream, so it can't be copied */
+	rc_Spline(const rc_Spline&) = delete;
+	rc_Spline& operator=(const rc_Spline&) = delete;
+
+	/** @brief parse the next number in a buffer, in place of fscanf's %f
+	*
+	*  @param p position to parse from, moved past the number
+	*  @param end end of the buffer
+	*  @param value receives the number
+	*  @return false if there is no number at p
+	*/
+	static bool parseFloat(const char*& p, const char* end, float& value);
+
 	
 	std::string folder;
 
@@ -64,6 +133,29 @@ public:
 	*/
 	void loadSplineFrom(std::string filename);
 
+	/** @brief segment files kept in the cache while streaming */
+	static const size_t STREAM_CACHED_SEGMENTS = 16;
+
+	/** @brief start reading a spline a window at a time instead of all at once
+	*
+	*  Only the current segment is kept in m_vPoints, and only the STREAM_CACHED_SEGMENTS most recently used
+	*  segment files are cached, so memory stays the same however long the track is
+	*  @param filename file containing the definition for this spline
+	*  @return false if the file can't be opened
+	*/
+	bool openStream(std::string filename);
+
+	/** @brief read the next control points of an open stream
+	*
+	*  @param out cleared, then receives up to maxPoints points in order
+	*  @param maxPoints size of the window
+	*  @return number of points read, 0 once the whole spline has been read and the file is closed
+	*/
+	size_t readStream(pointVector& out, size_t maxPoints);
+
+	/** @brief stop streaming early and close the file */
+	void closeStream();
+
 
 };
 
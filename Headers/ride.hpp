@@ -0,0 +1,137 @@
+#pragma once
+
+// The coaster ride as a fixed timestep simulation, kept apart from input and drawing
+//   The car carries its energy per unit mass, so its speed at height h follows from v^2 / 2 + g h = energy and
+//   does not drift over a long ride. Friction and air drag take energy away every step, and the chain lift never
+//   lets the car fall below liftSpeed (without a lift, any loss makes the car stall before the highest hill).
+//   advance() runs as many whole steps as the frame time covers, so a slow frame gives the same ride as
+//   several quick ones, and state() blends the last two steps for drawing
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+#include <track.hpp>
+
+struct RideParameters {
+	// gravity in track units per second squared
+	float gravity = 2.0f;
+	// length of one simulation step in seconds
+	float timeStep = 1.0f / 120.0f;
+	// most steps run by one advance, a longer hitch is dropped instead of caught up
+	int maxSteps = 30;
+	// the car starts with the energy to climb this far above the highest point of the track
+	float headroom = 0.5f;
+	// rolling friction coefficient, and air drag per unit of speed squared
+	float friction = 0.0f;
+	float drag = 0.0f;
+	// slowest the chain lift lets the car go, 0 for no lift
+	float liftSpeed = 0.0f;
+};
+
+// Where the car is, blended between the last two steps
+struct RideState {
+	double distance;
+	double s;
+	float velocity;
+};
+
+class Ride
+{
+public:
+	RideParameters parameters;
+	// energy per unit mass of the car
+	float energy = 0.0f;
+	// the last two steps, the previous distance is moved back with the current one when it wraps
+	double distance = 0.0;
+	double previousDistance = 0.0;
+	float velocity = 0.0f;
+	float previousVelocity = 0.0f;
+	// time not yet simulated, and steps taken since the start
+	float accumulator = 0.0f;
+	long long steps = 0;
+
+	Ride(Track& rideTrack, RideParameters rideParameters = RideParameters()) : track(rideTrack)
+	{
+		parameters = rideParameters;
+		reset();
+	}
+
+	// Put the car at startDistance with the starting energy, also call it after editing the track
+	void reset(double startDistance = 0.0)
+	{
+		distance = previousDistance = fmod(startDistance, track.trackLength);
+		if (distance < 0.0)
+			distance = previousDistance = distance + track.trackLength;
+		energy = parameters.gravity * (track.hmax + parameters.headroom);
+		velocity = previousVelocity = speed_at(height_at(distance));
+		accumulator = 0.0f;
+		steps = 0;
+	}
+
+	// Simulate frameTime more seconds in whole steps, the rest waits for the next frame
+	void advance(float frameTime)
+	{
+		accumulator += glm::max(frameTime, 0.0f);
+		int taken = 0;
+		while (accumulator >= parameters.timeStep && taken < parameters.maxSteps) {
+			step();
+			accumulator -= parameters.timeStep;
+			taken++;
+		}
+		if (taken == parameters.maxSteps)
+			accumulator = fmod(accumulator, parameters.timeStep);
+	}
+
+	// One step: the speed from the energy at the current height, move, then take off what friction and drag cost
+	void step()
+	{
+		float dt = parameters.timeStep;
+		previousDistance = distance;
+		previousVelocity = velocity;
+
+		velocity = speed_at(height_at(distance));
+		distance += double(velocity * dt);
+		if (distance >= track.trackLength) {
+			distance -= track.trackLength;
+			previousDistance -= track.trackLength;
+		}
+
+		float loss = (parameters.friction * parameters.gravity + parameters.drag * velocity * velocity) * velocity * dt;
+		energy -= loss;
+		steps++;
+	}
+
+	// The car between the last two steps, as far along as the time left over
+	RideState state()
+	{
+		float alpha = accumulator / parameters.timeStep;
+		RideState ride;
+		ride.distance = previousDistance + (distance - previousDistance) * alpha;
+		if (ride.distance < 0.0)
+			ride.distance += track.trackLength;
+		ride.s = track.get_param(ride.distance);
+		ride.velocity = previousVelocity + (velocity - previousVelocity) * alpha;
+		return ride;
+	}
+
+private:
+	Track& track;
+
+	// height of the rail centre line at a distance along the track
+	float height_at(double at)
+	{
+		return track.get_point(track.get_param(at)).y;
+	}
+
+	// speed the energy leaves at height h, the chain lift takes over below liftSpeed
+	float speed_at(float h)
+	{
+		float v = sqrt(glm::max(2.0f * (energy - parameters.gravity * h), 0.0f));
+		if (v < parameters.liftSpeed) {
+			v = parameters.liftSpeed;
+			energy = 0.5f * v * v + parameters.gravity * h;
+		}
+		return v;
+	}
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+// Ride and train physics on their own thread
+//   The simulation thread steps the Ride and the TrainSystem at a fixed rate on the wall clock, and after each wake up
+//   publishes a snapshot of the state before and after its last step through a lock-free triple buffer. The render
+//   thread takes the newest snapshot without waiting and blends its two states by how far the clock has moved on
+//   since it was taken, so it shows the ride one step behind real time. Neither thread ever waits for the other:
+//   a slow frame does not hold up the physics, and a slow step only means the frame shows an older snapshot.
+//   The thread holds the editMutex of every track it runs on while it steps, so an edit from the render thread
+//   waits for the step to finish and the next step sees the whole edit
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ride.hpp>
+#include <track.hpp>
+#include <train.hpp>
+
+// Single writer, single reader handoff of the newest value
+//   The writer fills its own slot and swaps it with the shared middle slot, the reader swaps its slot with the
+//   middle one when the writer has put something new there. Three slots mean neither side can touch the other's
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Slot the writer may fill
+	T& write_buffer() { return slots[back]; }
+
+	// Hand the filled slot to the reader, taking the middle slot to fill next
+	void publish()
+	{
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Take the newest published slot if there is one, true when read_buffer changed
+	bool update()
+	{
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+			return false;
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	// Slot the reader may use
+	const T& read_buffer() const { return slots[front]; }
+
+	// Every slot, only to set them up before the threads start
+	T& slot(int i) { return slots[i]; }
+
+private:
+	static const int INDEX = 3;
+	static const int FRESH = 4;
+
+	T slots[3];
+	int back = 0;
+	int front = 1;
+	std::atomic<int> middle{ 2 };
+};
+
+// The state of one simulation step: how far along its track the ridden car and every train car are
+struct SimulationState {
+	double rideDistance;
+	float rideVelocity;
+	std::vector<float> carDistance;
+};
+
+// What the simulation thread publishes, the states before and after its last step and when that step fell due
+struct SimulationSnapshot {
+	// seconds since the simulation started
+	double time;
+	long long step;
+	SimulationState previous;
+	SimulationState current;
+};
+
+class Simulation
+{
+public:
+	// length of a step, and the most steps taken in one wake up before the rest of the backlog is dropped
+	float timeStep;
+	int maxSteps = 30;
+	// whether the ridden car moves, the trains always do
+	std::atomic<bool> riding{ true };
+	// last step the simulation thread reached, and how many it dropped to get there
+	std::atomic<long long> steps{ 0 };
+	std::atomic<long long> droppedSteps{ 0 };
+
+	// The ride and the trains step at the ride's time step, they are only touched by the simulation thread once it starts
+	Simulation(Track& rideTrack, Ride& rideState, TrainSystem& trainSystem) : track(rideTrack), ride(rideState), trains(trainSystem)
+	{
+		timeStep = ride.parameters.timeStep;
+		trains.timeStep = timeStep;
+		for (const TrainFleet& fleet : trains.fleets) {
+			fleetTracks.push_back(fleet.track);
+			fleetFirstCar.push_back(carCount);
+			carCount += fleet.car_count();
+		}
+		fleetFirstCar.push_back(carCount);
+
+		//each track locked once, however many fleets share it
+		lockedTracks.push_back(&track);
+		for (Track* fleetTrack : fleetTracks) {
+			if (std::find(lockedTracks.begin(), lockedTracks.end(), fleetTrack) == lockedTracks.end())
+				lockedTracks.push_back(fleetTrack);
+		}
+
+		//every slot holds the starting state, so the reader has something to blend before the first publish
+		for (int i = 0; i < 3; i++) {
+			SimulationSnapshot& slot = buffer.slot(i);
+			slot.time = 0.0;
+			slot.step = 0;
+			capture(slot.previous);
+			capture(slot.current);
+		}
+		snapshot = buffer.read_buffer();
+	}
+
+	~Simulation()
+	{
+		stop();
+	}
+
+	Simulation(const Simulation&) = delete;
+	Simulation& operator=(const Simulation&) = delete;
+
+	void start()
+	{
+		if (thread.joinable())
+			return;
+		running = true;
+		startTime = std::chrono::steady_clock::now();
+		thread = std::thread(&Simulation::run, this);
+	}
+
+	void stop()
+	{
+		running = false;
+		if (thread.joinable())
+			thread.join();
+	}
+
+	// seconds on the simulation clock
+	double now() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	// Render thread: take the newest snapshot and work out how far to blend from its previous state to its current one
+	void update()
+	{
+		if (buffer.update())
+			snapshot = buffer.read_buffer();
+		blend = glm::clamp(float((now() - snapshot.time) / timeStep), 0.0f, 1.0f);
+	}
+
+	// Render thread: the ridden car at the blend of the last update
+	RideState ride_state()
+	{
+		RideState state;
+		state.distance = blend_distance(snapshot.previous.rideDistance, snapshot.current.rideDistance, track.trackLength);
+		state.s = track.get_param(state.distance);
+		state.velocity = snapshot.previous.rideVelocity + (snapshot.current.rideVelocity - snapshot.previous.rideVelocity) * blend;
+		return state;
+	}
+
+	// Render thread: the model matrix of every train car at the blend of the last update, in TrainSystem order
+	void car_transforms(const glm::mat4& carModel, std::vector<glm::mat4>& out)
+	{
+		out.resize(carCount);
+		for (size_t f = 0; f < fleetTracks.size(); f++) {
+			Track& fleetTrack = *fleetTracks[f];
+			for (int i = fleetFirstCar[f]; i < fleetFirstCar[f + 1]; i++) {
+				double distance = blend_distance(snapshot.previous.carDistance[i], snapshot.current.carDistance[i], fleetTrack.trackLength);
+				double s = fleetTrack.get_param(distance);
+				out[i] = TrainFleet::car_transform(fleetTrack, s, fleetTrack.get_point(s), carModel);
+			}
+		}
+	}
+
+	// the snapshot the render thread is drawing
+	const SimulationSnapshot& drawn() const { return snapshot; }
+
+private:
+	Track& track;
+	Ride& ride;
+	TrainSystem& trains;
+	std::vector<Track*> fleetTracks;
+	std::vector<int> fleetFirstCar;
+	int carCount = 0;
+	// the ride track and the fleet tracks, each once
+	std::vector<Track*> lockedTracks;
+
+	TripleBuffer<SimulationSnapshot> buffer;
+	std::thread thread;
+	std::atomic<bool> running{ false };
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+	// render thread copy of the newest snapshot, and how far between its states to draw
+	SimulationSnapshot snapshot;
+	float blend = 0.0f;
+
+	void capture(SimulationState& state)
+	{
+		state.rideDistance = ride.distance;
+		state.rideVelocity = ride.velocity;
+		state.carDistance.resize(carCount);
+		for (size_t f = 0; f < trains.fleets.size(); f++)
+			std::copy(trains.fleets[f].carDistance.begin(), trains.fleets[f].carDistance.end(), state.carDistance.begin() + fleetFirstCar[f]);
+	}
+
+	// Simulation thread: wake up every step, take every step that has fallen due and publish the last one
+	void run()
+	{
+		std::chrono::duration<double> step(timeStep);
+		long long taken = 0;
+		while (running) {
+			long long due = (long long)(now() / timeStep);
+			if (due - taken > maxSteps) {
+				droppedSteps += due - taken - maxSteps;
+				taken = due - maxSteps;
+			}
+			if (due > taken) {
+				SimulationSnapshot& next = buffer.write_buffer();
+				for (Track* locked : lockedTracks)
+					locked->editMutex.lock();
+				while (taken < due) {
+					if (taken + 1 == due)
+						capture(next.previous);
+					if (riding)
+						ride.step();
+					trains.step();
+					taken++;
+				}
+				for (Track* locked : lockedTracks)
+					locked->editMutex.unlock();
+				capture(next.current);
+				next.step = taken;
+				next.time = double(taken) * timeStep;
+				buffer.publish();
+				steps = taken;
+			}
+			std::this_thread::sleep_until(startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(step * double(taken + 1)));
+		}
+	}
+
+	// Blend two distances along a loop of length, taking the short way round the start
+	double blend_distance(double from, double to, double length)
+	{
+		double delta = to - from;
+		if (delta < -0.5 * length)
+			delta += length;
+		else if (delta > 0.5 * length)
+			delta -= length;
+		double distance = from + delta * blend;
+		if (distance < 0.0)
+			distance += length;
+		else if (distance >= length)
+			distance -= length;
+		return distance;
+	}
+};
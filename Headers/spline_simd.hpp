@@ -0,0 +1,226 @@
+#pragma once
+
+// Batch evaluation of the precomputed Catmull-Rom segments (see SplineSegment in track.hpp)
+//   Scalar, SSE and AVX2 versions of the same kernel, the widest one the CPU supports is picked at runtime
+//   unless RC_SPLINE_KERNEL names another (see best_spline_kernel)
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RC_SPLINE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need to be told a function may use AVX2, MSVC allows the intrinsics anywhere
+#if defined(RC_SPLINE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RC_TARGET_AVX2
+#endif
+
+enum SplineKernel {
+	SPLINE_KERNEL_SCALAR,
+	SPLINE_KERNEL_SSE,
+	SPLINE_KERNEL_AVX2
+};
+
+// Everything a kernel needs to evaluate sample i at s = sBegin + i * step, or at s = params[i] when params is set
+struct SplineBatch {
+	// segment coefficients a, b, c, d as 12 consecutive floats per segment
+	const float* coefficients;
+	int nSegments;
+	float sBegin;
+	float step;
+	const float* params = nullptr;
+	// structure-of-arrays output, x/y/z of the position and of the tangent dp/ds
+	float* position[3];
+	float* tangent[3];
+};
+
+// Evaluate samples [first, last) one at a time
+inline void sample_spline_scalar(const SplineBatch& batch, int first, int last)
+{
+	for (int i = first; i < last; i++) {
+		float s = batch.params ? batch.params[i] : batch.sBegin + float(i) * batch.step;
+		float whole = std::floor(s);
+		float u = s - whole;
+		int segment = (int(whole) - 2) % batch.nSegments;
+		if (segment < 0)
+			segment += batch.nSegments;
+
+		const float* c = batch.coefficients + segment * 12;
+		for (int k = 0; k < 3; k++) {
+			float a = c[k], b = c[3 + k], cc = c[6 + k], d = c[9 + k];
+			batch.position[k][i] = a + u * (b + u * (cc + u * d));
+			batch.tangent[k][i] = b + u * (2.0f * cc + u * 3.0f * d);
+		}
+	}
+}
+
+#ifdef RC_SPLINE_X86
+
+// SSE2 has no floor, truncate and step down for negative fractions
+inline __m128 floor_sse(__m128 x)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(x, t), _mm_set1_ps(1.0f)));
+}
+
+// Evaluate 4 samples at a time, coefficients are loaded lane by lane
+inline void sample_spline_sse(const SplineBatch& batch, int first, int last)
+{
+	const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 n = _mm_set1_ps(float(batch.nSegments));
+	const __m128 sBegin = _mm_set1_ps(batch.sBegin);
+	const __m128 step = _mm_set1_ps(batch.step);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+
+	int i = first;
+	for (; i + 4 <= last; i += 4) {
+		__m128 s = batch.params ? _mm_loadu_ps(batch.params + i) : _mm_add_ps(sBegin, _mm_mul_ps(_mm_add_ps(_mm_set1_ps(float(i)), lane), step));
+		__m128 whole = floor_sse(s);
+		__m128 u = _mm_sub_ps(s, whole);
+		__m128 segment = _mm_sub_ps(whole, two);
+		segment = _mm_sub_ps(segment, _mm_mul_ps(n, floor_sse(_mm_div_ps(segment, n))));
+
+		alignas(16) int index[4];
+		_mm_store_si128((__m128i*)index, _mm_cvttps_epi32(segment));
+		const float* c0 = batch.coefficients + index[0] * 12;
+		const float* c1 = batch.coefficients + index[1] * 12;
+		const float* c2 = batch.coefficients + index[2] * 12;
+		const float* c3 = batch.coefficients + index[3] * 12;
+
+		for (int k = 0; k < 3; k++) {
+			__m128 a = _mm_set_ps(c3[k], c2[k], c1[k], c0[k]);
+			__m128 b = _mm_set_ps(c3[3 + k], c2[3 + k], c1[3 + k], c0[3 + k]);
+			__m128 c = _mm_set_ps(c3[6 + k], c2[6 + k], c1[6 + k], c0[6 + k]);
+			__m128 d = _mm_set_ps(c3[9 + k], c2[9 + k], c1[9 + k], c0[9 + k]);
+
+			__m128 p = _mm_add_ps(a, _mm_mul_ps(u, _mm_add_ps(b, _mm_mul_ps(u, _mm_add_ps(c, _mm_mul_ps(u, d))))));
+			__m128 t = _mm_add_ps(b, _mm_mul_ps(u, _mm_add_ps(_mm_mul_ps(two, c), _mm_mul_ps(_mm_mul_ps(u, three), d))));
+			_mm_storeu_ps(batch.position[k] + i, p);
+			_mm_storeu_ps(batch.tangent[k] + i, t);
+		}
+	}
+	sample_spline_scalar(batch, i, last);
+}
+
+// Evaluate 8 samples at a time, coefficients are gathered straight from the segment array
+RC_TARGET_AVX2 inline void sample_spline_avx2(const SplineBatch& batch, int first, int last)
+{
+	const __m256 lane = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+	const __m256 n = _mm256_set1_ps(float(batch.nSegments));
+	const __m256 sBegin = _mm256_set1_ps(batch.sBegin);
+	const __m256 step = _mm256_set1_ps(batch.step);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	const __m256i stride = _mm256_set1_epi32(12);
+
+	int i = first;
+	for (; i + 8 <= last; i += 8) {
+		__m256 s = batch.params ? _mm256_loadu_ps(batch.params + i) : _mm256_add_ps(sBegin, _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(float(i)), lane), step));
+		__m256 whole = _mm256_floor_ps(s);
+		__m256 u = _mm256_sub_ps(s, whole);
+		__m256 segment = _mm256_sub_ps(whole, two);
+		segment = _mm256_sub_ps(segment, _mm256_mul_ps(n, _mm256_floor_ps(_mm256_div_ps(segment, n))));
+		__m256i base = _mm256_mullo_epi32(_mm256_cvttps_epi32(segment), stride);
+
+		for (int k = 0; k < 3; k++) {
+			__m256 a = _mm256_i32gather_ps(batch.coefficients, _mm256_add_epi32(base, _mm256_set1_epi32(k)), 4);
+			__m256 b = _mm256_i32gather_ps(batch.coefficients, _mm256_add_epi32(base, _mm256_set1_epi32(3 + k)), 4);
+			__m256 c = _mm256_i32gather_ps(batch.coefficients, _mm256_add_epi32(base, _mm256_set1_epi32(6 + k)), 4);
+			__m256 d = _mm256_i32gather_ps(batch.coefficients, _mm256_add_epi32(base, _mm256_set1_epi32(9 + k)), 4);
+
+			__m256 p = _mm256_add_ps(a, _mm256_mul_ps(u, _mm256_add_ps(b, _mm256_mul_ps(u, _mm256_add_ps(c, _mm256_mul_ps(u, d))))));
+			__m256 t = _mm256_add_ps(b, _mm256_mul_ps(u, _mm256_add_ps(_mm256_mul_ps(two, c), _mm256_mul_ps(_mm256_mul_ps(u, three), d))));
+			_mm256_storeu_ps(batch.position[k] + i, p);
+			_mm256_storeu_ps(batch.tangent[k] + i, t);
+		}
+	}
+	sample_spline_scalar(batch, i, last);
+}
+
+#endif
+
+// Ask the CPU (and on MSVC the OS) whether AVX2 can be used
+inline bool cpu_supports_avx2()
+{
+#if defined(RC_SPLINE_X86) && (defined(__GNUC__) || defined(__clang__))
+	return __builtin_cpu_supports("avx2");
+#elif defined(RC_SPLINE_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+
+// The widest kernel this machine can run, checked once
+inline SplineKernel widest_spline_kernel()
+{
+#ifdef RC_SPLINE_X86
+	static const SplineKernel kernel = cpu_supports_avx2() ? SPLINE_KERNEL_AVX2 : SPLINE_KERNEL_SSE;
+	return kernel;
+#else
+	return SPLINE_KERNEL_SCALAR;
+#endif
+}
+
+// The kernel used unless one is asked for, the widest this machine can run
+//   RC_SPLINE_KERNEL=scalar, sse or avx2 in the environment picks a narrower one instead, to test and time it
+inline SplineKernel best_spline_kernel()
+{
+	static const SplineKernel kernel = [] {
+		SplineKernel widest = widest_spline_kernel();
+		const char* name = std::getenv("RC_SPLINE_KERNEL");
+		if (name == nullptr)
+			return widest;
+		SplineKernel wanted = widest;
+		if (std::strcmp(name, "scalar") == 0)
+			wanted = SPLINE_KERNEL_SCALAR;
+		else if (std::strcmp(name, "sse") == 0)
+			wanted = SPLINE_KERNEL_SSE;
+		else if (std::strcmp(name, "avx2") == 0)
+			wanted = SPLINE_KERNEL_AVX2;
+		return wanted < widest ? wanted : widest;
+	}();
+	return kernel;
+}
+
+// Evaluate samples [0, count) with the requested kernel, falling back to scalar where it is not available
+inline void sample_spline(const SplineBatch& batch, int count, SplineKernel kernel)
+{
+#ifdef RC_SPLINE_X86
+	if (kernel == SPLINE_KERNEL_AVX2 && widest_spline_kernel() == SPLINE_KERNEL_AVX2) {
+		sample_spline_avx2(batch, 0, count);
+		return;
+	}
+	if (kernel != SPLINE_KERNEL_SCALAR) {
+		sample_spline_sse(batch, 0, count);
+		return;
+	}
+#endif
+	sample_spline_scalar(batch, 0, count);
+}
+
+// Name of a kernel for printing
+inline const char* spline_kernel_name(SplineKernel kernel)
+{
+	switch (kernel) {
+	case SPLINE_KERNEL_AVX2: return "AVX2";
+	case SPLINE_KERNEL_SSE: return "SSE";
+	default: return "scalar";
+	}
+}
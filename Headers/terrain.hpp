@@ -0,0 +1,349 @@
+#pragma once
+
+// Chunked level of detail terrain over a heightmap (continuous distance dependent level of detail, after Strugar's CDLOD)
+//   The heightmap is cut into a quadtree of square tiles, the leaves leafSize cells a side and each level up twice the
+//   size of the one below. Every frame the tree is walked from the root: a tile out of the frustum is dropped, and a
+//   tile is split into its children while they are within the distance range of their level, a child too far away
+//   for its level has its quarter drawn at the level of its parent. Every tile is drawn with the same grid of
+//   gridSize cells, stretched over the tile in the vertex shader, which reads the heights from a texture. The index
+//   buffer keeps the cells of each quarter of the grid together, so a quarter is a range of it.
+//   Towards the end of its range a tile morphs its odd vertices onto the even ones, so it already has the grid of the
+//   next level where it meets it: no cracks and no popping. Each level covers twice the distance of the one below,
+//   so about as many tiles are drawn at each level however big the heightmap, and the triangles drawn only grow with
+//   the number of levels
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+#include <frustum.hpp>
+#include <shader.hpp>
+
+// most levels of the quadtree, the size of the morph range array in terrainCDLOD.vert
+const int TERRAIN_MAX_LEVELS = 16;
+
+struct TerrainParameters {
+	// cells a side of the grid drawn for every tile, a power of two
+	int gridSize = 32;
+	// distance range of the finest level in leaf tile widths, each level up doubles it
+	float lodRange = 2.0f;
+	// fraction of its range a level covers before it starts morphing into the next one
+	float morphStart = 0.7f;
+};
+
+// A tile of the quadtree
+struct TerrainNode {
+	// first row and column of the heightmap it covers, and its width in cells
+	int row, column, size;
+	// 0 for the leaves
+	int level;
+	// lowest and highest height in it, and the world space box round them
+	float minHeight, maxHeight;
+	AABB bounds;
+	// the four quarters, rows first, -1 for a quarter that lies off the heightmap
+	int children[4];
+};
+
+class Terrain
+{
+public:
+	TerrainParameters parameters;
+	glm::mat4 model;
+	std::vector<TerrainNode> nodes;
+	// levels of the quadtree and cells a side of its leaves, gridSize unless the heightmap needs more than TERRAIN_MAX_LEVELS
+	int levels = 0;
+	int leafSize;
+	// distance from the camera each level is drawn to, and where it starts and finishes morphing into the next
+	float ranges[TERRAIN_MAX_LEVELS];
+	glm::vec2 morphRanges[TERRAIN_MAX_LEVELS];
+
+	// what the last select() picked
+	int visibleTiles = 0;
+	int culledTiles = 0;
+	long long visibleTriangles = 0;
+	int lodTiles[TERRAIN_MAX_LEVELS];
+
+	// Build the quadtree over a rows x columns heightmap, placed in the world by terrainModel like the Heightmap mesh
+	//   heightmapTexture is a single channel texture of the same heights to draw from, without it the heights are uploaded as R32F
+	Terrain(const float* heights, int rows, int columns, const glm::mat4& terrainModel, TerrainParameters terrainParameters = TerrainParameters(),
+		unsigned int heightmapTexture = 0)
+	{
+		parameters = terrainParameters;
+		model = terrainModel;
+		nRows = rows;
+		nColumns = columns;
+
+		int extent = glm::max(rows, columns) - 1;
+		leafSize = parameters.gridSize;
+		while ((long long)leafSize << (TERRAIN_MAX_LEVELS - 1) < extent)
+			leafSize *= 2;
+		levels = 1;
+		while ((long long)leafSize << (levels - 1) < extent)
+			levels++;
+		build_node(heights, 0, 0, leafSize << (levels - 1), levels - 1);
+
+		//ranges in world units from the width of a leaf, taking the longer of the two cell sizes
+		float cellSize = glm::max(glm::length(glm::vec3(model[0])) * 2.0f / float(rows - 1), glm::length(glm::vec3(model[2])) * 2.0f / float(columns - 1));
+		float previous = 0.0f;
+		for (int level = 0; level < TERRAIN_MAX_LEVELS; level++) {
+			ranges[level] = parameters.lodRange * float(leafSize << glm::min(level, levels - 1)) * cellSize;
+			morphRanges[level] = glm::vec2(previous + (ranges[level] - previous) * parameters.morphStart, ranges[level]);
+			previous = ranges[level];
+			lodTiles[level] = 0;
+		}
+
+		ownTexture = heightmapTexture == 0;
+		heightTexture = heightmapTexture;
+		setup_terrain(heights);
+	}
+
+	// Pick the tiles to draw from the camera: cull them against the frustum and choose their level by distance
+	void select(const glm::mat4& projection, const glm::mat4& view)
+	{
+		Frustum frustum(projection * view);
+		eye = glm::vec3(glm::inverse(view)[3]);
+
+		for (int group = 0; group < 5; group++)
+			tiles[group].clear();
+		visibleTiles = 0;
+		culledTiles = 0;
+		visibleTriangles = 0;
+		for (int level = 0; level < levels; level++)
+			lodTiles[level] = 0;
+
+		//the root is drawn whole even when the camera is beyond its range
+		if (!nodes.empty() && !select_node(0, frustum))
+			add_tile(nodes[0], 0);
+	}
+
+	// render the tiles of the last select()
+	void Draw(Shader shader, unsigned int textureID)
+	{
+		// Set the shader properties
+		shader.use();
+		shader.setMat4("model", model);
+		shader.setVec2("heightsSize", float(nRows), float(nColumns));
+		shader.setFloat("gridSize", float(parameters.gridSize));
+		shader.setVec3("cameraPos", eye);
+		for (int level = 0; level < levels; level++)
+			shader.setVec2("morphRanges[" + std::to_string(level) + "]", morphRanges[level]);
+		shader.setInt("heights", 1);
+
+		// Set material properties
+		shader.setVec3("material.specular", 0.3f, 0.3f, 0.3f);
+		shader.setFloat("material.shininess", 64.0f);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, heightTexture);
+
+		//every group of tiles in one instance buffer, whole tiles first then the quarters
+		instances.clear();
+		for (int group = 0; group < 5; group++)
+			instances.insert(instances.end(), tiles[group].begin(), tiles[group].end());
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::vec4), instances.empty() ? NULL : &instances[0], GL_STREAM_DRAW);
+
+		size_t quarterIndices = gridIndexCount / 4;
+		size_t first = 0;
+		for (int group = 0; group < 5; group++) {
+			if (tiles[group].empty())
+				continue;
+			glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)(first * sizeof(glm::vec4)));
+			GLsizei count = group == 0 ? gridIndexCount : quarterIndices;
+			const void* offset = (const void*)(group == 0 ? 0 : (group - 1) * quarterIndices * sizeof(unsigned int));
+			glDrawElementsInstanced(GL_TRIANGLES, count, GL_UNSIGNED_INT, offset, tiles[group].size());
+			first += tiles[group].size();
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	/*
+	Perform cleanup by deleting the buffers
+	*/
+	void delete_buffers()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteBuffers(1, &instanceVBO);
+		if (ownTexture)
+			glDeleteTextures(1, &heightTexture);
+	}
+
+private:
+	int nRows, nColumns;
+	glm::vec3 eye;
+	// tiles picked by select() as (row, column, size, level): whole tiles, then the quarters of tiles by quarter
+	std::vector<glm::vec4> tiles[5];
+	std::vector<glm::vec4> instances;
+
+	// Render data, the grid shared by every tile and the heights
+	unsigned int VAO, VBO, EBO, instanceVBO;
+	unsigned int heightTexture;
+	bool ownTexture;
+	GLsizei gridIndexCount;
+
+	// Add the tile of size cells at row, column and its children, returns its index
+	int build_node(const float* heights, int row, int column, int size, int level)
+	{
+		int n = nodes.size();
+		nodes.push_back(TerrainNode());
+		TerrainNode node;
+		node.row = row;
+		node.column = column;
+		node.size = size;
+		node.level = level;
+
+		float low = FLT_MAX, high = -FLT_MAX;
+		if (level == 0) {
+			int lastRow = glm::min(row + size, nRows - 1), lastColumn = glm::min(column + size, nColumns - 1);
+			for (int x = row; x <= lastRow; x++) {
+				const float* h = heights + size_t(x) * nColumns;
+				for (int y = column; y <= lastColumn; y++) {
+					low = glm::min(low, h[y]);
+					high = glm::max(high, h[y]);
+				}
+			}
+			for (int q = 0; q < 4; q++)
+				node.children[q] = -1;
+		}
+		else {
+			int half = size / 2;
+			for (int q = 0; q < 4; q++) {
+				int childRow = row + (q / 2) * half, childColumn = column + (q % 2) * half;
+				node.children[q] = -1;
+				if (childRow >= nRows - 1 || childColumn >= nColumns - 1)
+					continue;
+				node.children[q] = build_node(heights, childRow, childColumn, half, level - 1);
+				low = glm::min(low, nodes[node.children[q]].minHeight);
+				high = glm::max(high, nodes[node.children[q]].maxHeight);
+			}
+		}
+
+		node.minHeight = low;
+		node.maxHeight = high;
+
+		//the box in the world from the corners of the tile in heightmap space, clipped to the heightmap
+		float x0 = 2.0f * float(row) / float(nRows - 1) - 1.0f;
+		float x1 = 2.0f * float(glm::min(row + size, nRows - 1)) / float(nRows - 1) - 1.0f;
+		float z0 = 2.0f * float(column) / float(nColumns - 1) - 1.0f;
+		float z1 = 2.0f * float(glm::min(column + size, nColumns - 1)) / float(nColumns - 1) - 1.0f;
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec4 p(corner & 1 ? x1 : x0, corner & 2 ? high : low, corner & 4 ? z1 : z0, 1.0f);
+			node.bounds.expand(glm::vec3(model * p));
+		}
+		nodes[n] = node;
+		return n;
+	}
+
+	// Distance from the camera to a box, 0 inside it
+	float distance_to(const AABB& box) const
+	{
+		return glm::length(glm::max(glm::max(box.min - eye, eye - box.max), glm::vec3(0.0f)));
+	}
+
+	// Walk a tile: false when it is out of its level's range and left to its parent, true when it is drawn or culled
+	bool select_node(int n, const Frustum& frustum)
+	{
+		const TerrainNode& node = nodes[n];
+		float distance = distance_to(node.bounds);
+		if (distance > ranges[node.level])
+			return false;
+		if (!frustum.intersects(node.bounds)) {
+			culledTiles++;
+			return true;
+		}
+		if (node.level == 0 || distance > ranges[node.level - 1]) {
+			add_tile(node, 0);
+			return true;
+		}
+		for (int q = 0; q < 4; q++) {
+			int child = node.children[q];
+			if (child < 0 || select_node(child, frustum))
+				continue;
+			if (frustum.intersects(nodes[child].bounds))
+				add_tile(node, q + 1);
+			else
+				culledTiles++;
+		}
+		return true;
+	}
+
+	// Draw a tile whole (group 0) or one of its quarters (groups 1 to 4)
+	void add_tile(const TerrainNode& node, int group)
+	{
+		tiles[group].push_back(glm::vec4(float(node.row), float(node.column), float(node.size), float(node.level)));
+		visibleTiles++;
+		lodTiles[node.level]++;
+		visibleTriangles += (group == 0 ? gridIndexCount : gridIndexCount / 4) / 3;
+	}
+
+	void setup_terrain(const float* heights)
+	{
+		//the grid, one vertex per corner as (row, column) within the tile
+		int grid = parameters.gridSize;
+		std::vector<glm::vec2> gridVertices;
+		for (int x = 0; x <= grid; x++)
+			for (int y = 0; y <= grid; y++)
+				gridVertices.push_back(glm::vec2(float(x), float(y)));
+
+		//the cells of each quarter together, in the order of the children
+		std::vector<unsigned int> gridIndices;
+		int half = grid / 2;
+		for (int q = 0; q < 4; q++) {
+			for (int x = (q / 2) * half; x < (q / 2 + 1) * half; x++) {
+				for (int y = (q % 2) * half; y < (q % 2 + 1) * half; y++) {
+					unsigned int a = x * (grid + 1) + y;
+					unsigned int b = a + 1;
+					unsigned int c = a + grid + 1;
+					unsigned int d = c + 1;
+					gridIndices.insert(gridIndices.end(), { a, b, c, b, d, c });
+				}
+			}
+		}
+		gridIndexCount = gridIndices.size();
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glGenBuffers(1, &instanceVBO);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(glm::vec2), &gridVertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, gridIndices.size() * sizeof(unsigned int), &gridIndices[0], GL_STATIC_DRAW);
+
+		// one tile per instance
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+		glVertexAttribDivisor(1, 1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		//the heights as a float texture unless they are already on the GPU, the rows of the heightmap down t
+		if (!ownTexture)
+			return;
+		glGenTextures(1, &heightTexture);
+		glBindTexture(GL_TEXTURE_2D, heightTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, nColumns, nRows, 0, GL_RED, GL_FLOAT, heights);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+};
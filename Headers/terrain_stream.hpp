@@ -0,0 +1,432 @@
+#pragma once
+
+// Terrain streamed from a tiled height file (height_tiles.hpp) around the camera, with a fixed memory footprint
+//   The file is memory mapped, so opening it reads nothing but the index. Every frame update() asks for the tiles
+//   within radius of the camera, nearest first. A loader thread copies the ones that are not in memory yet out of
+//   the mapping into a fixed pool of CPU slots and drops the pages again, out of the process and out of the page
+//   cache, so neither grows with the distance travelled. The render thread then copies a few loaded tiles a frame into a fixed array of
+//   GPU texture layers. Both pools evict the least recently wanted tile, and never one that is wanted now, so no
+//   more tiles are asked for than the smaller pool holds. Draw() frustum culls the tiles on the GPU with their
+//   heights from the index and draws them all with one grid, displaced in terrainStream.vert.
+//   A wanted tile that is not on the GPU yet is left out of the frame
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <frustum.hpp>
+#include <height_tiles.hpp>
+#include <shader.hpp>
+
+// layers of a texture array every GL 3.3 implementation has to support
+const int TERRAIN_STREAM_MAX_LAYERS = 256;
+
+struct TerrainStreamParameters {
+	// bytes of tiles held in memory and on the GPU
+	size_t cpuBudget = size_t(64) << 20;
+	size_t gpuBudget = size_t(32) << 20;
+	// tiles are wanted this far from the camera, in world units
+	float radius = 4.0f;
+	// cells a side of the grid drawn over each tile, the tile is sampled every tileSize / gridSize samples
+	int gridSize = 64;
+	// most tiles copied to the GPU in one frame
+	int uploadsPerFrame = 8;
+};
+
+class TerrainStream
+{
+public:
+	TerrainStreamParameters parameters;
+	glm::mat4 model;
+	// tiles each pool holds
+	int cpuSlots = 0;
+	int gpuSlots = 0;
+
+	// what the loader thread has done so far
+	std::atomic<long long> tilesLoaded{ 0 };
+	std::atomic<long long> bytesLoaded{ 0 };
+	// what the last update() and Draw() did, missing tiles are wanted but not on the GPU yet
+	int wantedTiles = 0;
+	int uploadedTiles = 0;
+	int missingTiles = 0;
+	int visibleTiles = 0;
+
+	TerrainStream() {}
+
+	~TerrainStream()
+	{
+		close();
+	}
+
+	TerrainStream(const TerrainStream&) = delete;
+	TerrainStream& operator=(const TerrainStream&) = delete;
+
+	// Map a height tile file placed in the world by terrainModel like the Heightmap mesh, false if it cannot be read
+	bool open(const std::string& path, const glm::mat4& terrainModel, TerrainStreamParameters streamParameters = TerrainStreamParameters())
+	{
+		close();
+		parameters = streamParameters;
+		model = terrainModel;
+		file.reset(new MappedFile(path));
+		if (!read_height_tiles(*file, heightTiles)) {
+			file.reset();
+			return false;
+		}
+		const HeightTilesHeader& header = *heightTiles.header;
+		tileBytes = height_tile_bytes(header);
+		parameters.gridSize = glm::clamp(parameters.gridSize, 1, int(header.tileSize));
+
+		size_t tiles = heightTiles.tile_count();
+		cpuSlots = int(glm::min(glm::max(parameters.cpuBudget / tileBytes, size_t(1)), tiles));
+		gpuSlots = int(glm::min(glm::max(parameters.gpuBudget / tileBytes, size_t(1)), glm::min(tiles, size_t(TERRAIN_STREAM_MAX_LAYERS))));
+		cpu.assign(cpuSlots, CpuSlot());
+		gpu.assign(gpuSlots, GpuSlot());
+		cpuMemory.assign(size_t(cpuSlots) * tileBytes, 0);
+		cpuSlotOf.assign(tiles, -1);
+		gpuSlotOf.assign(tiles, -1);
+		wanted.clear();
+		frameWanted.clear();
+		generation = 0;
+		frame = 0;
+		tilesLoaded = 0;
+		bytesLoaded = 0;
+
+		setup_stream();
+		running = true;
+		loader = std::thread(&TerrainStream::load_tiles, this);
+		return true;
+	}
+
+	// Stop the loader and let go of the file and the GPU objects
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wake.notify_all();
+		if (loader.joinable())
+			loader.join();
+		if (file) {
+			delete_buffers();
+			file.reset();
+		}
+	}
+
+	bool is_open() const { return file != nullptr; }
+
+	// Render thread: ask for the tiles around the camera and copy the loaded ones the GPU does not have yet
+	void update(const glm::vec3& cameraPos)
+	{
+		if (!file)
+			return;
+		const HeightTilesHeader& header = *heightTiles.header;
+		frame++;
+
+		//the camera in samples of the terrain, and the radius in samples along each axis
+		glm::vec3 local = glm::vec3(glm::inverse(model) * glm::vec4(cameraPos, 1.0f));
+		float cellX = glm::length(glm::vec3(model[0])) * 2.0f / float(header.rows - 1);
+		float cellZ = glm::length(glm::vec3(model[2])) * 2.0f / float(header.columns - 1);
+		glm::vec2 camera((local.x + 1.0f) * 0.5f * float(header.rows - 1), (local.z + 1.0f) * 0.5f * float(header.columns - 1));
+		float tileSize = float(header.tileSize);
+		int down0 = glm::max(int(floor((camera.x - parameters.radius / cellX) / tileSize)), 0);
+		int down1 = glm::min(int(floor((camera.x + parameters.radius / cellX) / tileSize)), int(header.tilesDown) - 1);
+		int across0 = glm::max(int(floor((camera.y - parameters.radius / cellZ) / tileSize)), 0);
+		int across1 = glm::min(int(floor((camera.y + parameters.radius / cellZ) / tileSize)), int(header.tilesAcross) - 1);
+
+		//tiles whose square comes within the radius, nearest first and no more than the smaller pool holds
+		nearby.clear();
+		for (int down = down0; down <= down1; down++) {
+			for (int across = across0; across <= across1; across++) {
+				glm::vec2 corner(float(down) * tileSize, float(across) * tileSize);
+				glm::vec2 outside = glm::max(glm::max(corner - camera, camera - corner - tileSize), glm::vec2(0.0f));
+				float distance = glm::length(outside * glm::vec2(cellX, cellZ));
+				if (distance <= parameters.radius)
+					nearby.push_back(std::make_pair(distance, down * int(header.tilesAcross) + across));
+			}
+		}
+		std::sort(nearby.begin(), nearby.end());
+		nearby.resize(glm::min(nearby.size(), size_t(glm::min(cpuSlots, gpuSlots))));
+		frameWanted.clear();
+		for (const std::pair<float, int>& tile : nearby)
+			frameWanted.push_back(tile.second);
+		wantedTiles = frameWanted.size();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (frameWanted != wanted) {
+			wanted = frameWanted;
+			generation++;
+			for (int t : wanted)
+				if (cpuSlotOf[t] >= 0)
+					cpu[cpuSlotOf[t]].lastWanted = generation;
+			wake.notify_one();
+		}
+
+		//the tiles already on the GPU stay, then the nearest loaded ones are copied over the least recently used
+		for (int t : frameWanted)
+			if (gpuSlotOf[t] >= 0)
+				gpu[gpuSlotOf[t]].lastUsed = frame;
+		uploadedTiles = 0;
+		for (int t : frameWanted) {
+			if (uploadedTiles == parameters.uploadsPerFrame)
+				break;
+			int slot = cpuSlotOf[t];
+			if (gpuSlotOf[t] >= 0 || slot < 0 || !cpu[slot].ready)
+				continue;
+			int layer = 0;
+			for (int i = 1; i < gpuSlots; i++)
+				if (gpu[i].lastUsed < gpu[layer].lastUsed)
+					layer = i;
+			if (gpu[layer].tile >= 0)
+				gpuSlotOf[gpu[layer].tile] = -1;
+			gpu[layer].tile = t;
+			gpu[layer].lastUsed = frame;
+			gpuSlotOf[t] = layer;
+			upload_tile(layer, &cpuMemory[size_t(slot) * tileBytes]);
+			uploadedTiles++;
+		}
+		missingTiles = 0;
+		for (int t : frameWanted)
+			missingTiles += gpuSlotOf[t] < 0;
+	}
+
+	// Draw the wanted tiles that are on the GPU and inside the frustum
+	void Draw(Shader shader, unsigned int textureID, const glm::mat4& projection, const glm::mat4& view)
+	{
+		if (!file)
+			return;
+		const HeightTilesHeader& header = *heightTiles.header;
+		Frustum frustum(projection * view);
+
+		instances.clear();
+		for (int t : frameWanted) {
+			if (gpuSlotOf[t] < 0)
+				continue;
+			int down = t / header.tilesAcross, across = t % header.tilesAcross;
+			const HeightTileEntry& entry = heightTiles.index[t];
+			float x0 = 2.0f * float(down * header.tileSize) / float(header.rows - 1) - 1.0f;
+			float x1 = 2.0f * float(glm::min((down + 1) * header.tileSize, header.rows - 1)) / float(header.rows - 1) - 1.0f;
+			float z0 = 2.0f * float(across * header.tileSize) / float(header.columns - 1) - 1.0f;
+			float z1 = 2.0f * float(glm::min((across + 1) * header.tileSize, header.columns - 1)) / float(header.columns - 1) - 1.0f;
+			AABB bounds;
+			for (int corner = 0; corner < 8; corner++)
+				bounds.expand(glm::vec3(model * glm::vec4(corner & 1 ? x1 : x0, corner & 2 ? entry.maxHeight : entry.minHeight, corner & 4 ? z1 : z0, 1.0f)));
+			if (frustum.intersects(bounds))
+				instances.push_back(glm::vec3(float(down), float(across), float(gpuSlotOf[t])));
+		}
+		visibleTiles = instances.size();
+
+		// Set the shader properties
+		shader.use();
+		shader.setMat4("model", model);
+		shader.setInt("tiles", 1);
+		shader.setFloat("tileSize", float(header.tileSize));
+		shader.setFloat("tileBorder", float(HEIGHT_TILES_BORDER));
+		shader.setFloat("gridSize", float(parameters.gridSize));
+		shader.setVec2("terrainSize", float(header.rows), float(header.columns));
+
+		// Set material properties
+		shader.setVec3("material.specular", 0.3f, 0.3f, 0.3f);
+		shader.setFloat("material.shininess", 64.0f);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tileTexture);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::vec3), instances.empty() ? NULL : &instances[0], GL_STREAM_DRAW);
+		if (!instances.empty())
+			glDrawElementsInstanced(GL_TRIANGLES, gridIndexCount, GL_UNSIGNED_INT, 0, instances.size());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+
+		// always good practice to set everything back to defaults once configured.
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// bytes the two pools take, set by open() and the same however big the terrain
+	size_t cpu_bytes() const { return cpuMemory.size(); }
+	size_t gpu_bytes() const { return size_t(gpuSlots) * tileBytes; }
+
+	// tiles in memory, for the benchmark
+	int resident_tiles()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int n = 0;
+		for (const CpuSlot& slot : cpu)
+			n += slot.ready;
+		return n;
+	}
+
+private:
+	struct CpuSlot {
+		int tile = -1;
+		// generation of the wanted list that last asked for the tile
+		long long lastWanted = -1;
+		bool ready = false;
+	};
+	struct GpuSlot {
+		int tile = -1;
+		// frame that last wanted the tile
+		long long lastUsed = -1;
+	};
+
+	std::unique_ptr<MappedFile> file;
+	HeightTilesView heightTiles;
+	size_t tileBytes = 0;
+
+	// shared with the loader thread under mutex
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::thread loader;
+	bool running = false;
+	std::vector<int> wanted;
+	long long generation = 0;
+	std::vector<CpuSlot> cpu;
+	std::vector<int> cpuSlotOf;
+	std::vector<unsigned char> cpuMemory;
+
+	// render thread only
+	std::vector<GpuSlot> gpu;
+	std::vector<int> gpuSlotOf;
+	std::vector<int> frameWanted;
+	std::vector<std::pair<float, int>> nearby;
+	std::vector<glm::vec3> instances;
+	long long frame = 0;
+
+	// Render data, the grid shared by every tile and a texture layer per GPU slot
+	unsigned int VAO, VBO, EBO, instanceVBO;
+	unsigned int tileTexture;
+	GLsizei gridIndexCount;
+
+	// Loader thread: read the nearest wanted tile that is not in memory into the least recently wanted slot
+	void load_tiles()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (running) {
+			int tile = -1;
+			for (int t : wanted) {
+				if (cpuSlotOf[t] < 0) {
+					tile = t;
+					break;
+				}
+			}
+			int slot = -1;
+			for (int i = 0; i < cpuSlots && tile >= 0; i++)
+				if (cpu[i].lastWanted < generation && (slot < 0 || cpu[i].lastWanted < cpu[slot].lastWanted))
+					slot = i;
+			if (slot < 0) {
+				long long seen = generation;
+				wake.wait(lock, [&] { return !running || generation != seen; });
+				continue;
+			}
+
+			if (cpu[slot].tile >= 0)
+				cpuSlotOf[cpu[slot].tile] = -1;
+			cpu[slot].tile = tile;
+			cpu[slot].lastWanted = generation;
+			cpu[slot].ready = false;
+			cpuSlotOf[tile] = slot;
+
+			//only this thread writes a slot that is not ready, the render thread waits for it
+			lock.unlock();
+			const unsigned char* samples = heightTiles.tile(tile);
+			std::memcpy(&cpuMemory[size_t(slot) * tileBytes], samples, tileBytes);
+			//the pages were only needed for the copy, drop them so the mapping does not keep the terrain resident
+			file->drop_pages(samples, tileBytes);
+			lock.lock();
+			cpu[slot].ready = true;
+			tilesLoaded++;
+			bytesLoaded += tileBytes;
+		}
+	}
+
+	// Copy a tile into a layer of the texture array
+	void upload_tile(int layer, const unsigned char* samples)
+	{
+		int side = int(height_tile_side(*heightTiles.header));
+		GLenum type = heightTiles.header->format == HEIGHT_TILES_FLOAT ? GL_FLOAT : GL_UNSIGNED_SHORT;
+		// rows of 16 bit samples need not be 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tileTexture);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, side, side, 1, GL_RED, type, samples);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+
+	void setup_stream()
+	{
+		//the grid, one vertex per corner as (row, column) in cells of the grid
+		int grid = parameters.gridSize;
+		std::vector<glm::vec2> gridVertices;
+		for (int x = 0; x <= grid; x++)
+			for (int y = 0; y <= grid; y++)
+				gridVertices.push_back(glm::vec2(float(x), float(y)));
+		std::vector<unsigned int> gridIndices;
+		for (int x = 0; x < grid; x++) {
+			for (int y = 0; y < grid; y++) {
+				unsigned int a = x * (grid + 1) + y;
+				unsigned int b = a + 1;
+				unsigned int c = a + grid + 1;
+				unsigned int d = c + 1;
+				gridIndices.insert(gridIndices.end(), { a, b, c, b, d, c });
+			}
+		}
+		gridIndexCount = gridIndices.size();
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glGenBuffers(1, &instanceVBO);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(glm::vec2), &gridVertices[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, gridIndices.size() * sizeof(unsigned int), &gridIndices[0], GL_STATIC_DRAW);
+
+		// one tile per instance: tile row, tile column and layer
+		glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+		glVertexAttribDivisor(1, 1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		//every layer the GPU pool will ever use, allocated once
+		int side = int(height_tile_side(*heightTiles.header));
+		bool floats = heightTiles.header->format == HEIGHT_TILES_FLOAT;
+		glGenTextures(1, &tileTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tileTexture);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, floats ? GL_R32F : GL_R16, side, side, gpuSlots, 0, GL_RED, floats ? GL_FLOAT : GL_UNSIGNED_SHORT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	void delete_buffers()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		glDeleteBuffers(1, &instanceVBO);
+		glDeleteTextures(1, &tileTexture);
+	}
+};
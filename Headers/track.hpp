@@ -3,12 +3,21 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include <vector>
+#include <cfloat>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <type_traits>
 #include <iostream>
 
 #include <shader.hpp>
 #include <rc_spline.h>
+#include <spline_simd.hpp>
+#include <frustum.hpp>
+#include <track_file.hpp>
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include "glm/gtx/string_cast.hpp"
@@ -25,6 +34,244 @@ struct Orientation {
 	glm::vec3 origin;
 };
 
+// The frames of the track as an origin and a unit quaternion each, stored as structure of arrays
+//   28 bytes a frame against 48 for Orientation. The rotation takes the x, y and -z axes to Right, Up and Front,
+//   the same basis glm::lookAt builds, so it is also the car's rotation
+struct FrameTable {
+	std::vector<float> x, y, z;
+	std::vector<float> qx, qy, qz, qw;
+
+	size_t size() const { return x.size(); }
+
+	void resize(size_t n)
+	{
+		x.resize(n);
+		y.resize(n);
+		z.resize(n);
+		qx.resize(n);
+		qy.resize(n);
+		qz.resize(n);
+		qw.resize(n);
+	}
+
+	size_t bytes() const { return size() * 7 * sizeof(float); }
+
+	glm::vec3 origin(size_t i) const { return glm::vec3(x[i], y[i], z[i]); }
+	glm::quat rotation(size_t i) const { return glm::quat(qw[i], qx[i], qy[i], qz[i]); }
+
+	void set(size_t i, const Orientation& ori)
+	{
+		glm::quat q = glm::normalize(glm::quat_cast(glm::mat3(ori.Right, ori.Up, -ori.Front)));
+		x[i] = ori.origin.x;
+		y[i] = ori.origin.y;
+		z[i] = ori.origin.z;
+		qx[i] = q.x;
+		qy[i] = q.y;
+		qz[i] = q.z;
+		qw[i] = q.w;
+	}
+
+	Orientation get(size_t i) const { return orientation(origin(i), rotation(i)); }
+
+	// Blend frames i and j, the origin linearly and the rotation by nlerp along the shorter arc
+	void blend(size_t i, size_t j, float t, glm::vec3& blendOrigin, glm::quat& blendRotation) const
+	{
+		blendOrigin = origin(i) * (1.0f - t) + origin(j) * t;
+		float sign = qx[i] * qx[j] + qy[i] * qy[j] + qz[i] * qz[j] + qw[i] * qw[j] < 0.0f ? -t : t;
+		glm::quat q(qw[i] * (1.0f - t) + qw[j] * sign, qx[i] * (1.0f - t) + qx[j] * sign, qy[i] * (1.0f - t) + qy[j] * sign, qz[i] * (1.0f - t) + qz[j] * sign);
+		blendRotation = glm::normalize(q);
+	}
+
+	static Orientation orientation(glm::vec3 origin, glm::quat rotation)
+	{
+		glm::mat3 basis = glm::mat3_cast(rotation);
+		Orientation ori;
+		ori.Right = basis[0];
+		ori.Up = basis[1];
+		ori.Front = -basis[2];
+		ori.origin = origin;
+		return ori;
+	}
+
+	void assign(const std::vector<Orientation>& frames)
+	{
+		resize(frames.size());
+		for (size_t i = 0; i < frames.size(); i++)
+			set(i, frames[i]);
+	}
+
+	void get_all(std::vector<Orientation>& out) const
+	{
+		out.resize(size());
+		for (size_t i = 0; i < size(); i++)
+			out[i] = get(i);
+	}
+};
+
+// Cubic coefficients of one Catmull-Rom segment, p(u) = a + b*u + c*u^2 + d*u^3
+struct SplineSegment {
+	glm::vec3 a;
+	glm::vec3 b;
+	glm::vec3 c;
+	glm::vec3 d;
+};
+// the SIMD kernels in spline_simd.hpp read segments as 12 packed floats
+static_assert(sizeof(SplineSegment) == 12 * sizeof(float), "SplineSegment must be 12 packed floats");
+// track files store frames as 12 packed floats
+static_assert(sizeof(Orientation) == 12 * sizeof(float), "Orientation must be 12 packed floats");
+
+// Positions and tangents (dp/ds) from Track::sample, stored as structure of arrays
+struct SplineSamples {
+	std::vector<float> px, py, pz;
+	std::vector<float> tx, ty, tz;
+};
+
+// Struct mapping a distance along the track to a spline parameter
+struct ArcLengthSample {
+	// distance travelled from the start of the sample's segment (from the start of the track in track files)
+	float distance;
+	// control segment the sample lies on
+	int segment;
+	// point along the segment
+	float u;
+};
+// track files store the table as 3 packed 4 byte values per entry
+static_assert(sizeof(ArcLengthSample) == 3 * sizeof(float), "ArcLengthSample must be 3 packed values");
+
+// Running sums over values that can each change, a Fenwick tree
+//   Changing one value, the sum of the values before one and finding the value a running total falls in each take log n steps
+struct PrefixSums {
+	// tree[i] holds the sum of the lowest set bit of i values ending at value i - 1
+	std::vector<double> tree;
+
+	void assign(const std::vector<float>& values)
+	{
+		tree.assign(values.size() + 1, 0.0);
+		for (size_t i = 1; i < tree.size(); i++) {
+			tree[i] += values[i - 1];
+			size_t parent = i + (i & (~i + 1));
+			if (parent < tree.size())
+				tree[parent] += tree[i];
+		}
+	}
+
+	void add(size_t i, double delta)
+	{
+		for (i++; i < tree.size(); i += i & (~i + 1))
+			tree[i] += delta;
+	}
+
+	// sum of values [0, i)
+	double prefix(size_t i) const
+	{
+		double sum = 0.0;
+		for (; i > 0; i -= i & (~i + 1))
+			sum += tree[i];
+		return sum;
+	}
+
+	double total() const { return prefix(tree.size() - 1); }
+
+	// The value the running total reaches total in, total is left as how far into that value it is
+	size_t find(double& total) const
+	{
+		size_t n = tree.size() - 1, i = 0;
+		size_t step = 1;
+		while (step * 2 <= n)
+			step *= 2;
+		for (; step > 0; step /= 2) {
+			if (i + step <= n && tree[i + step] <= total) {
+				i += step;
+				total -= tree[i];
+			}
+		}
+		return glm::min(i, n - 1);
+	}
+};
+
+// Highest of values that can each change, a tournament tree: changing one value and reading the highest take log n steps
+struct RunningMax {
+	// leaves from tree[leaves], each node holds the higher of its two children
+	std::vector<float> tree;
+	size_t leaves = 0;
+
+	void assign(const std::vector<float>& values)
+	{
+		leaves = 1;
+		while (leaves < values.size())
+			leaves *= 2;
+		tree.assign(2 * leaves, -FLT_MAX);
+		std::copy(values.begin(), values.end(), tree.begin() + leaves);
+		for (size_t i = leaves - 1; i > 0; i--)
+			tree[i] = glm::max(tree[2 * i], tree[2 * i + 1]);
+	}
+
+	void set(size_t i, float value)
+	{
+		i += leaves;
+		tree[i] = value;
+		for (i /= 2; i > 0; i /= 2)
+			tree[i] = glm::max(tree[2 * i], tree[2 * i + 1]);
+	}
+
+	float highest() const { return leaves > 0 ? tree[1] : 0.0f; }
+};
+
+// Settings for building the track mesh
+struct TrackParameters {
+	// subdivide each segment by its curvature and torsion instead of a fixed count
+	bool adaptive = false;
+	// fixed mode: samples per segment
+	int subdivisions = 10;
+	// adaptive mode: how far the rails may stray from the true curve, and the most samples in one segment
+	float tolerance = 0.001f;
+	int maxSubdivisions = 32;
+	// samples per chunk for culling
+	int chunkSamples = 64;
+	// the coarsest level of detail whose error covers at most this many pixels is drawn
+	float lodPixelError = 1.0f;
+	// upload only the frames and build the rails and ties in the vertex shaders (railExtrude.vert, tieExtrude.vert)
+	bool gpuExtrusion = false;
+	// keep the generated frames, mesh, chunks and ties in a file next to the track and load them from there when nothing changed
+	bool meshCache = false;
+};
+
+// Levels of detail per chunk, level l keeps every 2^l th sample and every 2^l th tie, the last level drops the rail bottoms
+const int TRACK_LOD_LEVELS = 4;
+
+// A run of consecutive track samples that is culled as one piece
+struct TrackChunk {
+	// samples [firstSample, firstSample + sampleCount), their rail indices are contiguous
+	int firstSample;
+	int sampleCount;
+	// ties [firstTie, firstTie + tieCount) of tieTransforms
+	int firstTie;
+	int tieCount;
+	// bounds of the rails alone, and of the rails and ties together
+	AABB railBounds;
+	AABB bounds;
+	// rail indices of each level of detail in railIndices (only the counts with GPU extrusion), and how far that level can stray from the full mesh
+	unsigned int lodFirstIndex[TRACK_LOD_LEVELS];
+	int lodIndexCount[TRACK_LOD_LEVELS];
+	float lodError[TRACK_LOD_LEVELS];
+	// level picked by the last cull
+	int lod;
+};
+
+// Number of samples taken per control segment when building the arc length table
+const int ARC_LENGTH_SUBDIVISIONS = 32;
+
+// Rail cross section: 2 rails x 4 faces x 2 vertices per sample, and 2 rails x 4 faces x 2 triangles between samples
+const int RAIL_RING_VERTICES = 16;
+const int RAIL_SEGMENT_INDICES = 48;
+// Simplified cross section without the bottom faces
+const int RAIL_SIMPLE_SEGMENT_INDICES = 36;
+// Frame of a sample packed for the GPU: origin with texture v in w, then the FrameTable quaternion as x, y, z, w
+const int FRAME_TEXELS = 2;
+// Unit tie box: 6 faces x 4 vertices, 6 faces x 2 triangles
+const int TIE_VERTICES = 24;
+const int TIE_INDICES = 36;
+
 
 class Track
 {
@@ -36,124 +283,691 @@ public:
 	// Vector of control points
 	std::vector<glm::vec3> controlPoints;
 
-	// Track data
-	std::vector<Vertex> rightRailVertices;
-	std::vector<Vertex> leftRailVertices;
-	std::vector<Vertex> tieVertices;
-
-	// Vector of Orientations
-	std::vector<Orientation> orientations;
+	// Polynomial coefficients for each control segment, segment i starts at s = i + 2
+	std::vector<SplineSegment> segments;
 
-	// hmax for camera
+	// Track data, both rails share one ring of vertices per sample
+	std::vector<Vertex> railVertices;
+	std::vector<unsigned int> railIndices;
+	// One unit tie box, drawn once per entry of tieTransforms
+	std::vector<Vertex> tieVertices;
+	std::vector<unsigned int> tieIndices;
+	std::vector<glm::mat4> tieTransforms;
+	// Frame position (sample index + blend) of each tie, all the tie shader needs with GPU extrusion
+	std::vector<float> tieFrames;
+	// s of each tie, in track order
+	std::vector<float> tieParams;
+
+	// Distance between ties along the track
+	float tieSpacing = 0.2f;
+
+	// Frame of every sample
+	FrameTable frameTable;
+	// Frames packed for the GPU, FRAME_TEXELS per sample: origin with texture v in w, rotation
+	std::vector<glm::vec4> frameTexels;
+	// s of each orientation
+	std::vector<float> sampleParams;
+	// Number of orientations in each segment, and the index of the first one
+	std::vector<int> segmentSamples;
+	std::vector<int> segmentSampleStart;
+
+	// How the track was tessellated
+	TrackParameters parameters;
+
+	// Chunks in track order, and how many passed the frustum test in the last Draw
+	std::vector<TrackChunk> chunks;
+	int visibleChunks = 0;
+	int culledChunks = 0;
+	int visibleTriangles = 0;
+	// Chunks drawn at each level of detail in the last Draw
+	int lodChunks[TRACK_LOD_LEVELS] = {};
+
+	// Height of the viewport in pixels, for the screen space error
+	float screenHeight = 720.0f;
+
+	// Bytes sent to the GPU by the last edit
+	size_t editUploadBytes = 0;
+	// Held by every edit, and by the simulation thread while it steps along the track
+	std::mutex editMutex;
+
+	// The frames and arc length table came from a compiled track file, only true while the constructor runs
+	bool framesLoaded = false;
+
+	// Arc length table, maps distance into a segment to (segment, u), ARC_LENGTH_SUBDIVISIONS entries per segment
+	//   and one closing the loop. Distances count from the start of the segment, so an edit only touches its own segments
+	std::vector<ArcLengthSample> arcLengthTable;
+	// Length of each segment, and their running sums giving the distance to the start of each one
+	std::vector<float> segmentLengths;
+	PrefixSums segmentDistances;
+	// Total length of the track
+	double trackLength = 0.0;
+
+	// height of the highest sample, kept up to date through edits for the ride
 	float hmax = 0.0f;
+	// highest sample of each chunk, so an edit only measures the chunks it touched
+	RunningMax chunkHeights;
 
 
 	// constructor, just use same VBO as before, 
-	Track(const char* trackPath)
+	Track(const char* trackPath, TrackParameters trackParameters = TrackParameters())
 	{
+		parameters = trackParameters;
+
+
 		// load Track data
 		load_track(trackPath);
 
-		create_track();
+		std::string cachePath = std::string(trackPath) + ".meshcache";
+		if (!parameters.meshCache || !load_mesh_cache(cachePath)) {
+			create_track();
+
+			if (!framesLoaded)
+				create_arc_length_table();
 
+			create_chunks();
+
+			create_ties();
+
+			if (parameters.meshCache)
+				save_mesh_cache(cachePath);
+		}
+		framesLoaded = false;
+
+		measure_height();
 		setup_track();
 	}
 
-	// render the mesh
-	void Draw(Shader shader, unsigned int textureID1, unsigned int textureID2)
+	// Work out which chunks are inside the view frustum, pick a level of detail for each,
+	//   and collect their rail index ranges and tie runs. Neighbouring ranges that follow on in the index buffer are merged,
+	//   and so are tie runs, and with GPU extrusion rail runs, where that draws exactly the ties and rings of each chunk
+	//   The level is the coarsest one whose error, projected at the distance to the chunk, stays under lodPixelError
+	void cull(const glm::mat4& projection, const glm::mat4& view)
 	{
-		//draw right rail
-		shader.use();
-		glm::mat4 rail_model;
-		shader.setMat4("model", rail_model);
+		Frustum frustum(projection * view);
+		glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+		// pixels covered by one unit at distance one
+		float pixelsPerUnit = 0.5f * screenHeight * projection[1][1];
+
+		drawCounts.clear();
+		drawOffsets.clear();
+		railRuns.clear();
+		tieRuns.clear();
+		visibleChunks = 0;
+		culledChunks = 0;
+		visibleTriangles = 0;
+		for (int level = 0; level < TRACK_LOD_LEVELS; level++)
+			lodChunks[level] = 0;
+
+		int previousLevel = -1;
+		for (TrackChunk& chunk : chunks) {
+			if (!frustum.intersects(chunk.bounds)) {
+				culledChunks++;
+				previousLevel = -1;
+				continue;
+			}
+			visibleChunks++;
+
+			glm::vec3 outside = glm::max(glm::max(chunk.bounds.min - eye, eye - chunk.bounds.max), glm::vec3(0.0f));
+			float distance = glm::max(glm::length(outside), 1e-3f);
+			int level = 0;
+			while (level + 1 < TRACK_LOD_LEVELS && chunk.lodError[level + 1] * pixelsPerUnit / distance <= parameters.lodPixelError)
+				level++;
+			chunk.lod = level;
+			lodChunks[level]++;
+
+			GLsizei count = chunk.lodIndexCount[level];
+			int stride = 1 << level;
+			int ties = (chunk.tieCount + stride - 1) / stride;
+			visibleTriangles += count / 3 + ties * TIE_INDICES / 3;
+
+			//a run continues into the next chunk only when that picks the same rings and ties as drawing the chunk on its own:
+			//  the chunks follow on and the run so far is a whole number of strides
+			if (parameters.gpuExtrusion) {
+				glm::ivec3* run = railRuns.empty() ? nullptr : &railRuns.back();
+				if (previousLevel == level && run->x + run->y == chunk.firstSample && run->y % stride == 0)
+					run->y += chunk.sampleCount;
+				else
+					railRuns.push_back(glm::ivec3(chunk.firstSample, chunk.sampleCount, level));
+			}
+			else {
+				const void* offset = (const void*)(size_t(chunk.lodFirstIndex[level]) * sizeof(unsigned int));
+				if (previousLevel >= 0 && (const char*)drawOffsets.back() + drawCounts.back() * sizeof(unsigned int) == offset)
+					drawCounts.back() += count;
+				else {
+					drawCounts.push_back(count);
+					drawOffsets.push_back(offset);
+				}
+			}
+			glm::ivec3* run = tieRuns.empty() ? nullptr : &tieRuns.back();
+			if (previousLevel == level && run->x + run->y == chunk.firstTie && run->y % stride == 0)
+				run->y += chunk.tieCount;
+			else
+				tieRuns.push_back(glm::ivec3(chunk.firstTie, chunk.tieCount, stride));
+			previousLevel = level;
+		}
+	}
 
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID1);
+	// render the mesh, only the chunks inside the view frustum are drawn, each at its level of detail
+	//   tieShader reads the tie transform from the instance attributes
+	void Draw(Shader shader, Shader tieShader, const glm::mat4& projection, const glm::mat4& view, unsigned int textureID1, unsigned int textureID2)
+	{
+		cull(projection, view);
 
-		glBindVertexArray(rightRailVAO);
-		glDrawArrays(GL_TRIANGLES, 0, rightRailVertices.size());
+		//with GPU extrusion both shaders read the frames from texture unit 3
+		if (parameters.gpuExtrusion) {
+			glActiveTexture(GL_TEXTURE3);
+			glBindTexture(GL_TEXTURE_BUFFER, frameTexture);
+		}
 
-		//draw left rail
+		//draw both rails, one range per run of visible chunks
 		shader.use();
+		glm::mat4 rail_model;
 		shader.setMat4("model", rail_model);
+		if (parameters.gpuExtrusion) {
+			shader.setInt("frames", 3);
+			shader.setInt("frameCount", frameTable.size());
+			shader.setVec3("railOffset", railOffset);
+		}
 
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, textureID1);
 
-		glBindVertexArray(leftRailVAO);
-		glDrawArrays(GL_TRIANGLES, 0, leftRailVertices.size());
+		glBindVertexArray(railVAO);
+		if (parameters.gpuExtrusion) {
+			//railExtrude.vert works out the ring pair and corner of each vertex from gl_VertexID and the run
+			for (const glm::ivec3& run : railRuns) {
+				int stride = 1 << run.z;
+				bool simple = run.z == TRACK_LOD_LEVELS - 1;
+				shader.setInt("firstSample", run.x);
+				shader.setInt("endSample", run.x + run.y);
+				shader.setInt("stride", stride);
+				shader.setBool("simple", simple);
+				glDrawArrays(GL_TRIANGLES, 0, (run.y + stride - 1) / stride * (simple ? RAIL_SIMPLE_SEGMENT_INDICES : RAIL_SEGMENT_INDICES));
+			}
+		}
+		else
+			glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT, drawOffsets.data(), drawCounts.size());
 
-		//draw ties
-		shader.use();
+		//draw the ties of each run of visible chunks from the one box
+		tieShader.use();
 		glm::mat4 tie_model;
-		shader.setMat4("model", tie_model);
+		tieShader.setMat4("model", tie_model);
+		if (parameters.gpuExtrusion) {
+			tieShader.setInt("frames", 3);
+			tieShader.setInt("frameCount", frameTable.size());
+			tieShader.setVec3("railOffset", railOffset);
+			tieShader.setVec3("tieOffset", tieOffset);
+		}
 
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, textureID2);
 
 		glBindVertexArray(tieVAO);
-		glDrawArrays(GL_TRIANGLES, 0, tieVertices.size());
+		for (const glm::ivec3& run : tieRuns) {
+			if (run.y == 0)
+				continue;
+			point_tie_instances(run.x, run.z);
+			glDrawElementsInstanced(GL_TRIANGLES, tieIndices.size(), GL_UNSIGNED_INT, 0, (run.y + run.z - 1) / run.z);
+		}
 
 		glBindVertexArray(0);
 		glActiveTexture(GL_TEXTURE0);
 	}
 
-	// give a positive float s, find the point by interpolation
-	// determine pA, pB, pC, pD based on the integer of s
+	// give a positive s, find the point by interpolation
+	// determine the segment based on the integer of s, wrapping around at the end of the track
 	// determine u based on the decimal of s
-	// E.g. s=1.5 is the at the halfway point between the 1st and 2nd control point,
+	// E.g. s=2.5 is the halfway point of segment 0, between control points 1 and 2,
 	//		the 4 control points are:[0,1,2,3], with u=0.5
-	glm::vec3 get_point(float s)
+	// s is a double so u keeps its precision on tracks of millions of segments, where a float s would step by 1/16
+	glm::vec3 get_point(double s)
 	{	
-		//control points for interpolation
-		int pA = floor(s) - 2;
-		int pB = floor(s) - 1;
-		int pC = floor(s);
-		int pD = floor(s) + 1;
-		float u = s - floor(s); //point along spline between the control points
-		
-		//these are for looping back to the beginning when the control points are reaching the end of the list
-		if (pA == -1) {
-			pA = controlPoints.size() - 1;
+		int segment;
+		float u;
+		get_segment(s, segment, u);
+
+		// Horner's rule on the precomputed coefficients
+		const SplineSegment& seg = segments[segment];
+		return seg.a + u * (seg.b + u * (seg.c + u * seg.d));
+	}
+
+	// Same as get_point, also giving the first and second derivative with respect to s
+	void evaluate(double s, glm::vec3& position, glm::vec3& firstDerivative, glm::vec3& secondDerivative)
+	{
+		int segment;
+		float u;
+		get_segment(s, segment, u);
+
+		const SplineSegment& seg = segments[segment];
+		position = seg.a + u * (seg.b + u * (seg.c + u * seg.d));
+		firstDerivative = seg.b + u * (2.0f * seg.c + u * 3.0f * seg.d);
+		secondDerivative = 2.0f * seg.c + u * 6.0f * seg.d;
+	}
+
+	// Curvature of the track at s, |p' x p''| / |p'|^3
+	float get_curvature(double s)
+	{
+		glm::vec3 position, firstDerivative, secondDerivative;
+		evaluate(s, position, firstDerivative, secondDerivative);
+
+		float speed = glm::length(firstDerivative);
+		if (speed < 1e-6f)
+			return 0.0f;
+		return glm::length(glm::cross(firstDerivative, secondDerivative)) / (speed * speed * speed);
+	}
+
+	// Torsion of the track at s, (p' x p'') . p''' / |p' x p''|^2
+	float get_torsion(double s)
+	{
+		glm::vec3 position, firstDerivative, secondDerivative;
+		evaluate(s, position, firstDerivative, secondDerivative);
+
+		int segment;
+		float u;
+		get_segment(s, segment, u);
+		glm::vec3 thirdDerivative = 6.0f * segments[segment].d;
+
+		glm::vec3 binormal = glm::cross(firstDerivative, secondDerivative);
+		float length2 = glm::dot(binormal, binormal);
+		if (length2 < 1e-12f)
+			return 0.0f;
+		return glm::dot(binormal, thirdDerivative) / length2;
+	}
+
+	// Pick the number of samples in each segment
+	//   Fixed mode uses the same count everywhere. Adaptive mode spaces samples so the chord between two of them
+	//   sags at most tolerance from the curve: a curve bending at curvature k sags k*h^2/8 over a chord of length h,
+	//   and twisting at torsion t swings the rails, r away from the centre, out by about r*t^2*h^2/8
+	void choose_subdivisions(const TrackParameters& settings, std::vector<int>& out)
+	{
+		int n = segments.size();
+		out.resize(n);
+		if (!settings.adaptive) {
+			for (int k = 0; k < n; k++)
+				out[k] = settings.subdivisions;
+			return;
 		}
-		if (pD == controlPoints.size()) {
-			pD = 0;
+
+		for (int k = 0; k < n; k++)
+			out[k] = segment_subdivisions(segments[k], settings, 0.1f + railOffset.x);
+	}
+
+	// Adaptive sample count of one segment, enough that the chord error s^2 * bend / 8 of a step s stays under the tolerance
+	//   bend is the curvature plus what the torsion adds at the rails, railDistance from the centre line
+	static int segment_subdivisions(const SplineSegment& seg, const TrackParameters& settings, float railDistance)
+	{
+		const int probes = 8;
+		float length = 0.0f;
+		float bend = 0.0f;
+		glm::vec3 prev = seg.a;
+		for (int p = 0; p < probes; p++) {
+			float u = float(p + 1) / float(probes);
+			glm::vec3 next = seg.a + u * (seg.b + u * (seg.c + u * seg.d));
+			length += glm::distance(prev, next);
+			prev = next;
+
+			//curvature |p' x p''| / |p'|^3 and torsion (p' x p'') . p''' / |p' x p''|^2 halfway between probes
+			u = (float(p) + 0.5f) / float(probes);
+			glm::vec3 firstDerivative = seg.b + u * (2.0f * seg.c + u * 3.0f * seg.d);
+			glm::vec3 secondDerivative = 2.0f * seg.c + u * 6.0f * seg.d;
+			glm::vec3 binormal = glm::cross(firstDerivative, secondDerivative);
+			float speed = glm::length(firstDerivative);
+			float length2 = glm::dot(binormal, binormal);
+			float curvature = speed < 1e-6f ? 0.0f : glm::length(binormal) / (speed * speed * speed);
+			float torsion = length2 < 1e-12f ? 0.0f : glm::dot(binormal, 6.0f * seg.d) / length2;
+			bend = glm::max(bend, curvature + railDistance * torsion * torsion);
 		}
-		if (pC == controlPoints.size()) {
-			pD = 1;
-			pC = 0;
+
+		int count = 1;
+		if (bend > 1e-6f)
+			count = int(ceil(length / sqrt(8.0f * settings.tolerance / bend)));
+		return glm::clamp(count, 1, settings.maxSubdivisions);
+	}
+
+	// Cubic coefficients of the segment running from pB to pC, the same as expanding interpolate below
+	static SplineSegment make_segment(glm::vec3 pA, glm::vec3 pB, glm::vec3 pC, glm::vec3 pD, float tau)
+	{
+		SplineSegment seg;
+		seg.a = pB;
+		seg.b = tau * (pC - pA);
+		seg.c = 2.0f * tau * pA + (tau - 3.0f) * pB + (3.0f - 2.0f * tau) * pC - tau * pD;
+		seg.d = -tau * pA + (2.0f - tau) * pB + (tau - 2.0f) * pC + tau * pD;
+		return seg;
+	}
+
+	// Transform of the unit tie sitting on the frame ori
+	static glm::mat4 make_tie_transform(const Orientation& ori, glm::vec3 railOffset, glm::vec3 tieOffset)
+	{
+		glm::mat4 transform;
+		transform[0] = glm::vec4(ori.Right * tieOffset, 0.0f);
+		transform[1] = glm::vec4(ori.Up * (0.05f - railOffset.y), 0.0f);
+		transform[2] = glm::vec4(ori.Front * railOffset, 0.0f);
+		transform[3] = glm::vec4(ori.origin - ori.Up * railOffset, 1.0f);
+		return transform;
+	}
+
+	// give s, blend between the two nearest frames
+	Orientation get_orientation(double s)
+	{
+		glm::vec3 origin;
+		glm::quat rotation;
+		get_pose(s, origin, rotation);
+		return FrameTable::orientation(origin, rotation);
+	}
+
+	// give s, the origin and rotation blended between the two nearest frames, one nlerp for all three axes
+	void get_pose(double s, glm::vec3& origin, glm::quat& rotation)
+	{
+		double frame = get_frame(s);
+		int index = int(frame);
+		frameTable.blend(index, (index + 1) % frameTable.size(), float(frame - double(index)), origin, rotation);
+	}
+
+	// give s, find the orientation it falls after plus how far it is towards the next one
+	double get_frame(double s)
+	{
+		int segment;
+		float u;
+		get_segment(s, segment, u);
+
+		float x = u * float(segmentSamples[segment]);
+		int step = glm::min(int(floor(x)), segmentSamples[segment] - 1);
+		return double(segmentSampleStart[segment] + step) + double(x - float(step));
+	}
+
+	// Change the distance between ties, only the per tie data is rebuilt and uploaded
+	void set_tie_spacing(float spacing)
+	{
+		tieSpacing = spacing;
+		create_ties();
+		upload_ties();
+	}
+
+	// Move control point i and update the track in place
+	//   A Catmull-Rom point only shapes the 4 segments i-3 to i, so only their samples, frames, rings
+	//   and arc length entries are redone, and only those byte ranges are sent to the GPU.
+	//   The segments keep their sample counts, call rebuild to tessellate again after big changes
+	void moveControlPoint(int i, glm::vec3 position)
+	{
+		std::lock_guard<std::mutex> lock(editMutex);
+		int n = controlPoints.size();
+		i = ((i % n) + n) % n;
+		controlPoints[i] = position;
+		editUploadBytes = 0;
+
+		//the touched segments in track order, split in two where they wrap past the start
+		std::vector<int> edited;
+		for (int k = i - 3; k <= i; k++)
+			edited.push_back((k + n) % n);
+		std::sort(edited.begin(), edited.end());
+		edited.erase(std::unique(edited.begin(), edited.end()), edited.end());
+		for (int k : edited)
+			update_segment(k, 0.5f);
+
+		std::vector<glm::ivec2> ranges;
+		for (int k : edited) {
+			int first = segmentSampleStart[k];
+			int last = first + segmentSamples[k];
+			if (!ranges.empty() && ranges.back().y == first)
+				ranges.back().y = last;
+			else
+				ranges.push_back(glm::ivec2(first, last));
 		}
-		if (pB == controlPoints.size()) {
-			pD = 2;
-			pC = 1;
-			pB = 0;
+
+		for (glm::ivec2 range : ranges)
+			update_frames(range.x, range.y);
+		update_arc_length_table(edited);
+
+		//the chunks the new rings land in, plus the one joining onto ring 0
+		std::vector<bool> touched(chunks.size(), false);
+		for (glm::ivec2 range : ranges) {
+			for (int c = chunk_of(glm::max(range.x - 1, 0)); c <= chunk_of(range.y - 1); c++)
+				touched[c] = true;
+			if (range.x == 0)
+				touched[chunks.size() - 1] = true;
 		}
+		for (int c = 0; c < int(chunks.size()); c++) {
+			if (touched[c]) {
+				bound_chunk(chunks[c]);
+				measure_chunk_lod(chunks[c]);
+				chunkHeights.set(c, chunk_height(chunks[c]));
+			}
+		}
+		hmax = chunkHeights.highest();
 
-		return interpolate(controlPoints[pA], controlPoints[pB], controlPoints[pC], controlPoints[pD], 0.5f, u);
+		update_ties(ranges, touched);
 	}
 
-	// Perform cleanup 
-	void delete_buffers()
+	// Add a control point before point i
+	//   Every later sample, index and tie moves along, so the derived data is built again
+	void insertControlPoint(int i, glm::vec3 position)
 	{
-		glDeleteVertexArrays(1, &rightRailVAO);
-		glDeleteBuffers(1, &rightRailVBO);
-		glDeleteVertexArrays(1, &leftRailVAO);
-		glDeleteBuffers(1, &leftRailVBO);
-		glDeleteVertexArrays(1, &tieVAO);
-		glDeleteBuffers(1, &tieVBO);
+		std::lock_guard<std::mutex> lock(editMutex);
+		i = glm::clamp(i, 0, int(controlPoints.size()));
+		controlPoints.insert(controlPoints.begin() + i, position);
+		build();
 	}
 
-private:
-	/*  Render data  */
-	unsigned int rightRailVAO, rightRailVBO, leftRailVAO, leftRailVBO, tieVAO, tieVBO;
+	// Take out control point i, a closed Catmull-Rom loop needs at least 4
+	void removeControlPoint(int i)
+	{
+		std::lock_guard<std::mutex> lock(editMutex);
+		if (controlPoints.size() <= 4 || i < 0 || i >= int(controlPoints.size()))
+			return;
+		controlPoints.erase(controlPoints.begin() + i);
+		build();
+	}
 
-	void load_track(const char* trackPath)
+	// Write the control points, frames and arc length table to a compiled track file, relative to the media folder
+	//   Loading spline/track.sp picks up spline/track.spb instead when it exists
+	bool save_binary(const char* path)
 	{
-		// Set folder path for our projects (easier than repeatedly defining it)
-		g_Track.folder = "../Project_2/Media/";
+		TrackFileHeader header = {};
+		header.nControlPoints = controlPoints.size();
+		header.nSamples = frameTable.size();
+		header.nArcLength = arcLengthTable.size();
+		header.adaptive = parameters.adaptive;
+		header.subdivisions = parameters.subdivisions;
+		header.tolerance = parameters.tolerance;
+		header.maxSubdivisions = parameters.maxSubdivisions;
+		const float* frames[TRACK_FILE_FRAME_ARRAYS] = { frameTable.x.data(), frameTable.y.data(), frameTable.z.data(),
+			frameTable.qx.data(), frameTable.qy.data(), frameTable.qz.data(), frameTable.qw.data() };
+		std::vector<ArcLengthSample> table;
+		get_track_arc_length_table(table);
+		return write_track_file(g_Track.folder + path, header, &controlPoints[0].x, segmentSamples.data(), frames, table.data());
+	}
 
-		// Load the control points
-		g_Track.loadSplineFrom(trackPath);
+	// Build everything after the control points again and send it to the GPU
+	void rebuild()
+	{
+		std::lock_guard<std::mutex> lock(editMutex);
+		build();
+	}
+
+	// give s, find the distance along the track from the arc length table
+	double get_distance(double s)
+	{
+		int segment;
+		float u;
+		get_segment(s, segment, u);
+
+		float x = u * float(ARC_LENGTH_SUBDIVISIONS);
+		int step = glm::min(int(floor(x)), ARC_LENGTH_SUBDIVISIONS - 1);
+		float a = arcLengthTable[segment * ARC_LENGTH_SUBDIVISIONS + step].distance;
+		float b = step + 1 < ARC_LENGTH_SUBDIVISIONS ? arcLengthTable[segment * ARC_LENGTH_SUBDIVISIONS + step + 1].distance : segmentLengths[segment];
+		return segmentDistances.prefix(segment) + double(a + (b - a) * (x - float(step)));
+	}
+
+	// Send the frames to the buffer texture again after they changed, with GPU extrusion nothing else has to follow
+	void upload_frames()
+	{
+		pack_frames(frameTable, sampleParams, frameTexels);
+		glBindBuffer(GL_TEXTURE_BUFFER, frameTBO);
+		glBufferData(GL_TEXTURE_BUFFER, frameTexels.size() * sizeof(glm::vec4), frameTexels.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Pack the frames FRAME_TEXELS each for the buffer texture, the shaders blend the rotations the same way as FrameTable::blend
+	static void pack_frames(const FrameTable& frames, const std::vector<float>& params, std::vector<glm::vec4>& out)
+	{
+		out.resize(frames.size() * FRAME_TEXELS);
+		for (size_t i = 0; i < frames.size(); i++)
+			pack_frame(frames, i, params[i], &out[i * FRAME_TEXELS]);
+	}
+
+	static void pack_frame(const FrameTable& frames, size_t i, float param, glm::vec4* out)
+	{
+		out[0] = glm::vec4(frames.origin(i), (param - 2.0f) * 10.0f);
+		out[1] = glm::vec4(frames.qx[i], frames.qy[i], frames.qz[i], frames.qw[i]);
+	}
+
+	// Mesh generation phase one: each frame is built from the previous Up so this pass runs in order
+	static void create_frames(const SplineSamples& samples, int count, Orientation ori_prev, std::vector<Orientation>& out)
+	{
+		out.resize(count);
+		for (int i = 0; i < count; i++) {
+			glm::vec3 origin(samples.px[i], samples.py[i], samples.pz[i]);
+			glm::vec3 tangent(samples.tx[i], samples.ty[i], samples.tz[i]);
+			next_frame(ori_prev, origin, tangent, out[i]);
+			ori_prev = out[i];
+		}
+	}
+
+	// Build one frame from the sample and the frame before it
+	static void next_frame(const Orientation& ori_prev, glm::vec3 origin, glm::vec3 tangent, Orientation& ori_cur)
+	{
+		//calculate the orientations and origins of each point along the curve
+		//Front is the tangent of the spline
+		ori_cur.origin = origin;
+		if (glm::length(tangent) > 1e-6f)
+			ori_cur.Front = glm::normalize(tangent);
+		else
+			ori_cur.Front = glm::normalize(ori_cur.origin - ori_prev.origin);
+		turn_frame(ori_prev, ori_cur);
+	}
+
+	// Turn Right and Up to follow Front, starting from the previous Up
+	static void turn_frame(const Orientation& ori_prev, Orientation& ori_cur)
+	{
+		ori_cur.Right = glm::normalize(glm::cross(ori_cur.Front, ori_prev.Up));
+		ori_cur.Up = glm::normalize(glm::cross(ori_cur.Right, ori_cur.Front));
+	}
+
+	// Mesh generation phase two: a ring and its indices only depend on its own frame,
+	//   so the frames are split into one contiguous block per thread writing straight into the sized buffers.
+	//   The output is the same whatever the thread count. The texture runs along the rails by s
+	static void create_rail_mesh(const std::vector<Orientation>& frames, const std::vector<float>& params, glm::vec3 railOffset, unsigned int nThreads,
+		std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		int nSamples = frames.size();
+		vertices.resize(nSamples * RAIL_RING_VERTICES);
+		indices.resize(nSamples * RAIL_SEGMENT_INDICES);
+
+		//one ring of rail vertices per sample, the last sample joins back onto the first
+		auto build = [&](int first, int last) {
+			for (int i = first; i < last; i++) {
+				make_rail_ring(frames[i], (params[i] - 2.0f) * 10.0f, railOffset, &vertices[i * RAIL_RING_VERTICES]);
+				make_rail_indices(i * RAIL_RING_VERTICES, ((i + 1) % nSamples) * RAIL_RING_VERTICES, &indices[i * RAIL_SEGMENT_INDICES]);
+			}
+		};
+
+		//not worth starting threads for small tracks
+		const int minSamplesPerThread = 4096;
+		if (nThreads > unsigned(nSamples / minSamplesPerThread))
+			nThreads = nSamples / minSamplesPerThread;
+		if (nThreads < 1)
+			nThreads = 1;
+
+		std::vector<std::thread> workers;
+		for (unsigned int t = 1; t < nThreads; t++)
+			workers.emplace_back(build, int((long long)nSamples * t / nThreads), int((long long)nSamples * (t + 1) / nThreads));
+		build(0, int((long long)nSamples / nThreads));
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	// Evaluate counts[k] points evenly spaced over each segment k, one batch per segment
+	void sample_segments(const std::vector<int>& counts, SplineSamples& out, SplineKernel kernel = best_spline_kernel())
+	{
+		int total = 0;
+		for (int count : counts)
+			total += count;
+		out.px.resize(total);
+		out.py.resize(total);
+		out.pz.resize(total);
+		out.tx.resize(total);
+		out.ty.resize(total);
+		out.tz.resize(total);
+
+		SplineBatch batch;
+		batch.coefficients = &segments[0].a.x;
+		batch.nSegments = segments.size();
+		int first = 0;
+		for (int k = 0; k < int(counts.size()); k++) {
+			batch.sBegin = float(k) + 2.0f;
+			batch.step = 1.0f / float(counts[k]);
+			batch.position[0] = out.px.data() + first;
+			batch.position[1] = out.py.data() + first;
+			batch.position[2] = out.pz.data() + first;
+			batch.tangent[0] = out.tx.data() + first;
+			batch.tangent[1] = out.ty.data() + first;
+			batch.tangent[2] = out.tz.data() + first;
+
+			sample_spline(batch, counts[k], kernel);
+			first += counts[k];
+		}
+	}
+
+	// Evaluate count points evenly spaced over [sBegin, sEnd) in one batch
+	//   Positions and tangents are written as structure of arrays so the SIMD kernels can store whole registers
+	void sample(float sBegin, float sEnd, int count, SplineSamples& out, SplineKernel kernel = best_spline_kernel())
+	{
+		out.px.resize(count);
+		out.py.resize(count);
+		out.pz.resize(count);
+		out.tx.resize(count);
+		out.ty.resize(count);
+		out.tz.resize(count);
+
+		SplineBatch batch;
+		batch.coefficients = &segments[0].a.x;
+		batch.nSegments = segments.size();
+		batch.sBegin = sBegin;
+		batch.step = (sEnd - sBegin) / float(count);
+		batch.position[0] = out.px.data();
+		batch.position[1] = out.py.data();
+		batch.position[2] = out.pz.data();
+		batch.tangent[0] = out.tx.data();
+		batch.tangent[1] = out.ty.data();
+		batch.tangent[2] = out.tz.data();
+
+		sample_spline(batch, count, kernel);
+	}
+
+	// give a distance along the track, find the matching s
+	// the running segment lengths give the segment in log n steps and a binary search its table entry,
+	// so the cost does not depend on how far we move per frame
+	// E.g. distance=0 is s=2, the start of the track
+	// Both are doubles, a float distance or s loses the position along a segment on tracks of millions of segments
+	double get_param(double distance)
+	{
+		// wrap around to the start of the track
+		distance = fmod(distance, trackLength);
+		if (distance < 0.0)
+			distance += trackLength;
+
+		double into = distance;
+		int segment = segmentDistances.find(into);
+		const ArcLengthSample* entries = &arcLengthTable[segment * ARC_LENGTH_SUBDIVISIONS];
+		int step = int(std::upper_bound(entries + 1, entries + ARC_LENGTH_SUBDIVISIONS, float(into),
+			[](float d, const ArcLengthSample& e) { return d < e.distance; }) - entries) - 1;
+
+		const ArcLengthSample& a = entries[step];
+		float bDistance = step + 1 < ARC_LENGTH_SUBDIVISIONS ? entries[step + 1].distance : segmentLengths[segment];
+		float bU = step + 1 < ARC_LENGTH_SUBDIVISIONS ? entries[step + 1].u : 1.0f;
+		float t = (bDistance > a.distance) ? glm::clamp((float(into) - a.distance) / (bDistance - a.distance), 0.0f, 1.0f) : 0.0f;
+
+		return double(segment) + 2.0 + double(a.u + (bU - a.u) * t);
 	}
 
 	// Implement the Catmull-Rom Spline here
@@ -182,13 +996,127 @@ private:
 		return point;
 	}
 
-	// Here is the class where you will make the Vertices or positions of the necessary objects of the track (calling subfunctions)
-	//  For example, to make a basic roller coster:
-	//    First, make the Vertices for each rail here (and indices for the EBO if you do it that way).  
-	//        You need the XYZ world coordinates, the Normal Coordinates, and the texture coordinates.
-	//        The normal coordinates are necessary for the lighting to work.  
-	//    Second, make vector of transformations for the planks across the rails
-	void create_track()
+	// Perform cleanup 
+	void delete_buffers()
+	{
+		glDeleteVertexArrays(1, &railVAO);
+		glDeleteBuffers(1, &railVBO);
+		glDeleteBuffers(1, &railEBO);
+		glDeleteVertexArrays(1, &tieVAO);
+		glDeleteBuffers(1, &tieVBO);
+		glDeleteBuffers(1, &tieEBO);
+		glDeleteBuffers(1, &tieInstanceVBO);
+		if (parameters.gpuExtrusion) {
+			glDeleteBuffers(1, &frameTBO);
+			glDeleteTextures(1, &frameTexture);
+		}
+	}
+
+private:
+	// Build everything after the control points again and send it to the GPU, with editMutex held
+	void build()
+	{
+		delete_buffers();
+		create_track();
+		create_arc_length_table();
+		create_chunks();
+		create_ties();
+		measure_height();
+		setup_track();
+	}
+
+	/*  Render data  */
+	unsigned int railVAO, railVBO, railEBO, tieVAO, tieVBO, tieEBO, tieInstanceVBO;
+	// Frames for GPU extrusion, the buffer and the buffer texture reading it
+	unsigned int frameTBO = 0, frameTexture = 0;
+
+	// Draw lists filled by cull: rail index counts and byte offsets, and (first tie, tie count, tie stride) runs
+	std::vector<GLsizei> drawCounts;
+	std::vector<const void*> drawOffsets;
+	// With GPU extrusion the rail draw list instead: (first sample, sample count, level) runs
+	std::vector<glm::ivec3> railRuns;
+	std::vector<glm::ivec3> tieRuns;
+
+	//set offsets multipliers to reduce the size of the objects
+	glm::vec3 railOffset = glm::vec3(0.02f, 0.02f, 0.02f);
+	glm::vec3 tieOffset = glm::vec3(0.15f, 0.15f, 0.15f);
+
+	void load_track(const char* trackPath)
+	{
+		// Set folder path for our projects (easier than repeatedly defining it)
+		g_Track.folder = "../Project_2/Media/";
+
+		// A compiled track next to the text one is used when there is one
+		if (load_binary_track(binary_track_path(trackPath)))
+			return;
+
+		// Load the control points
+		g_Track.loadSplineFrom(trackPath);
+		create_control_points();
+	}
+
+	// Load the control points, and the frames if they were built with the same tessellation, from a mapped track file
+	bool load_binary_track(const std::string& path)
+	{
+		MappedFile file(g_Track.folder + path);
+		TrackFileView view;
+		if (!read_track_file(file, view) || view.header->nControlPoints < 4)
+			return false;
+
+		const TrackFileHeader& header = *view.header;
+		const glm::vec3* points = (const glm::vec3*)view.controlPoints;
+		controlPoints.assign(points, points + header.nControlPoints);
+
+		bool sameTessellation = (header.adaptive != 0) == parameters.adaptive && (parameters.adaptive ?
+			header.tolerance == parameters.tolerance && header.maxSubdivisions == parameters.maxSubdivisions :
+			header.subdivisions == parameters.subdivisions);
+		long long total = 0;
+		for (uint32_t k = 0; view.frames && k < header.nControlPoints; k++)
+			total += view.segmentSamples[k];
+		if (view.frames && sameTessellation && total == header.nSamples && header.nArcLength == header.nControlPoints * ARC_LENGTH_SUBDIVISIONS + 1) {
+			segmentSamples.assign(view.segmentSamples, view.segmentSamples + header.nControlPoints);
+			std::vector<float>* columns[7] = { &frameTable.x, &frameTable.y, &frameTable.z, &frameTable.qx, &frameTable.qy, &frameTable.qz, &frameTable.qw };
+			for (int c = 0; c < TRACK_FILE_FRAME_ARRAYS; c++)
+				columns[c]->assign(view.frames + size_t(c) * header.nSamples, view.frames + size_t(c + 1) * header.nSamples);
+			set_track_arc_length_table((const ArcLengthSample*)view.arcLength, header.nArcLength);
+			framesLoaded = true;
+		}
+		return true;
+	}
+
+	// Split s into a segment index and the point u along it
+	//   Segment i uses control points i, i+1, i+2, i+3 so it runs between control points i+1 and i+2
+	void get_segment(double s, int& segment, float& u)
+	{
+		double whole = floor(s);
+		u = float(s - whole);
+		segment = (int(whole) - 2) % int(segments.size());
+		if (segment < 0)
+			segment += segments.size();
+	}
+
+	// Precompute the cubic coefficients of every segment, the same as expanding interpolate above
+	void create_segments(float tau)
+	{
+		int n = controlPoints.size();
+		segments.resize(n);
+		for (int i = 0; i < n; i++)
+			update_segment(i, tau);
+	}
+
+	// Coefficients of segment i from control points i to i+3
+	void update_segment(int i, float tau)
+	{
+		int n = controlPoints.size();
+		glm::vec3 pA = controlPoints[i];
+		glm::vec3 pB = controlPoints[(i + 1) % n];
+		glm::vec3 pC = controlPoints[(i + 2) % n];
+		glm::vec3 pD = controlPoints[(i + 3) % n];
+		segments[i] = make_segment(pA, pB, pC, pD, tau);
+	}
+
+	// The spline files hold the step to each control point, add them up into positions
+	void create_control_points()
 	{
 		glm::vec3 currentpos = glm::vec3(0.0f, 0.0f, 0.0f);
 		//iterate throught the points g_Track.points() returns the vector containing all the control points
@@ -200,362 +1128,724 @@ private:
 
 			controlPoints.push_back(currentpos);
 		}
+	}
 
-		Orientation ori_prev;
-		//set initial orientation
-		ori_prev.origin = get_point(1.9);
-		ori_prev.Front = glm::vec3(1.0f, 0.0f, 0.0f);
-		ori_prev.Right = glm::vec3(0.0f, 0.0f, 1.0f);
-		ori_prev.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+	// The frame the first sample is built from
+	Orientation initial_orientation()
+	{
+		Orientation ori;
+		ori.origin = get_point(1.9);
+		ori.Front = glm::vec3(1.0f, 0.0f, 0.0f);
+		ori.Right = glm::vec3(0.0f, 0.0f, 1.0f);
+		ori.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+		return ori;
+	}
 
-		Orientation	ori_cur;
+	// Here is the class where you will make the Vertices or positions of the necessary objects of the track (calling subfunctions)
+	//  For example, to make a basic roller coster:
+	//    First, make the Vertices for each rail here (and indices for the EBO if you do it that way).  
+	//        You need the XYZ world coordinates, the Normal Coordinates, and the texture coordinates.
+	//        The normal coordinates are necessary for the lighting to work.  
+	//    Second, make vector of transformations for the planks across the rails
+	void create_track()
+	{
+		create_segments(0.5f);
+
+		Orientation ori_prev = initial_orientation();
+
+		//sample every segment in batches, as often as the tessellation mode asks for
+		if (!framesLoaded)
+			choose_subdivisions(parameters, segmentSamples);
+		create_sample_params();
+		int nSamples = sampleParams.size();
+		std::vector<Orientation> orientations;
+		if (!framesLoaded) {
+			SplineSamples samples;
+			sample_segments(segmentSamples, samples);
+			create_frames(samples, nSamples, ori_prev, orientations);
+			frameTable.assign(orientations);
+		}
+		//the mesh is built from the frames as stored, so loading the table from a file gives the same mesh
+		frameTable.get_all(orientations);
+		//with GPU extrusion railExtrude.vert makes the rings and their triangles from the frames alone
+		if (parameters.gpuExtrusion) {
+			railVertices.clear();
+			railIndices.clear();
+			pack_frames(frameTable, sampleParams, frameTexels);
+		}
+		else
+			create_rail_mesh(orientations, sampleParams, railOffset, std::thread::hardware_concurrency(), railVertices, railIndices);
 
-		//set offsets multipliers to reduce the size of the objects
-		glm::vec3 railOffset = glm::vec3(0.02f, 0.02f, 0.02f);
-		glm::vec3 tieOffset = glm::vec3(0.15f, 0.15f, 0.15f);
+		create_unit_tie();
+	}
 
-		bool placeTie = false; //bool to tell make triangle to place a tie
+	// Where each segment's samples start and the s of every sample, from the sample counts
+	void create_sample_params()
+	{
+		segmentSampleStart.resize(segmentSamples.size());
+		sampleParams.clear();
+		for (int k = 0; k < int(segmentSamples.size()); k++) {
+			segmentSampleStart[k] = sampleParams.size();
+			for (int j = 0; j < segmentSamples[k]; j++)
+				sampleParams.push_back(float(k) + 2.0f + float(j) / float(segmentSamples[k]));
+		}
+	}
 
-		int counter = 0;
-		for (float s = 2; s < controlPoints.size() + 2; s += 0.1) {
+	// the tie box, placed by the instance transforms
+	void create_unit_tie()
+	{
+		tieVertices.resize(TIE_VERTICES);
+		tieIndices.resize(TIE_INDICES);
+		make_unit_tie(&tieVertices[0], &tieIndices[0]);
+	}
 
-			//calculate the orientations and origins of each point along the curve
-			ori_cur.origin = get_point(s);
-			ori_cur.Front = glm::normalize((ori_cur.origin - ori_prev.origin) / glm::length(ori_cur.origin - ori_prev.origin));
-			ori_cur.Right = glm::normalize(glm::cross(ori_cur.Front, ori_prev.Up));
-			ori_cur.Up = glm::normalize(glm::cross(ori_cur.Right, ori_cur.Front));
+	// Hash of everything the generated data depends on: the control points, the settings and the layout of the data
+	uint64_t mesh_cache_key()
+	{
+		uint64_t key = hash_bytes(controlPoints.data(), controlPoints.size() * sizeof(glm::vec3));
+		int layout[] = { MESH_CACHE_VERSION, ARC_LENGTH_SUBDIVISIONS, RAIL_RING_VERTICES, RAIL_SEGMENT_INDICES, TRACK_LOD_LEVELS,
+			int(sizeof(Vertex)), int(sizeof(TrackChunk)), parameters.adaptive, parameters.subdivisions, parameters.maxSubdivisions,
+			parameters.chunkSamples, parameters.gpuExtrusion };
+		float settings[] = { parameters.tolerance, tieSpacing, railOffset.x, railOffset.y, railOffset.z, tieOffset.x, tieOffset.y, tieOffset.z };
+		key = hash_bytes(layout, sizeof(layout), key);
+		return hash_bytes(settings, sizeof(settings), key);
+	}
 
-			makeRailPart(ori_prev, ori_cur, railOffset, tieOffset, placeTie);
+	// The arrays kept in the mesh cache, in file order
+	std::vector<std::pair<const void*, uint64_t>> mesh_cache_sections()
+	{
+		std::vector<std::pair<const void*, uint64_t>> sections;
+		auto add = [&](const auto& v) { sections.push_back(std::make_pair((const void*)v.data(), uint64_t(v.size() * sizeof(v[0])))); };
+		add(segmentSamples);
+		add(frameTable.x);
+		add(frameTable.y);
+		add(frameTable.z);
+		add(frameTable.qx);
+		add(frameTable.qy);
+		add(frameTable.qz);
+		add(frameTable.qw);
+		add(arcLengthTable);
+		add(railVertices);
+		add(railIndices);
+		add(chunks);
+		add(tieParams);
+		add(tieFrames);
+		add(tieTransforms);
+		add(frameTexels);
+		add(segmentLengths);
+		return sections;
+	}
 
-			//place a tie every two points along the curve
-			if (counter%2 == 0) {
-				placeTie = true;}
-			else {
-				placeTie = false;}
-			orientations.push_back(ori_cur);
-			ori_prev = ori_cur;
-			counter++;
+	// Write the generated data to the cache file, relative to the media folder
+	bool save_mesh_cache(const std::string& path)
+	{
+		return write_mesh_cache(g_Track.folder + path, mesh_cache_key(), mesh_cache_sections());
+	}
+
+	// Load the generated data from the cache file if it was made from the same control points and settings
+	//   The arrays are copied out of the mapping once, the rest is cheap to work out again
+	bool load_mesh_cache(const std::string& path)
+	{
+		static_assert(std::is_trivially_copyable<TrackChunk>::value, "TrackChunk is stored as raw bytes");
+		MappedFile file(g_Track.folder + path);
+		std::vector<std::pair<const unsigned char*, uint64_t>> sections;
+		if (!read_mesh_cache(file, mesh_cache_key(), sections) || sections.size() != mesh_cache_sections().size())
+			return false;
+
+		//check every section fits what it should hold before touching the track, a miss leaves it as it was
+		auto count = [&](size_t i, size_t size) { return sections[i].second % size == 0 ? sections[i].second / size : ~uint64_t(0); };
+		uint64_t nTies = count(12, sizeof(float));
+		if (count(0, sizeof(int)) != controlPoints.size() ||
+			count(8, sizeof(ArcLengthSample)) != controlPoints.size() * ARC_LENGTH_SUBDIVISIONS + 1 ||
+			count(9, sizeof(Vertex)) == ~uint64_t(0) || count(10, sizeof(unsigned int)) == ~uint64_t(0) ||
+			count(11, sizeof(TrackChunk)) == ~uint64_t(0) || nTies == ~uint64_t(0) ||
+			count(13, sizeof(float)) != nTies || count(14, sizeof(glm::mat4)) != nTies || count(15, sizeof(glm::vec4)) == ~uint64_t(0) ||
+			count(16, sizeof(float)) != controlPoints.size())
+			return false;
+		uint64_t nSamples = 0;
+		for (uint64_t k = 0; k < controlPoints.size(); k++)
+			nSamples += ((const int*)sections[0].first)[k];
+		for (size_t i = 1; i <= 7; i++)
+			if (count(i, sizeof(float)) != nSamples)
+				return false;
+
+		size_t next = 0;
+		auto take = [&](auto& v) {
+			typedef typename std::remove_reference<decltype(v[0])>::type T;
+			const std::pair<const unsigned char*, uint64_t>& section = sections[next++];
+			v.assign((const T*)section.first, (const T*)(section.first + section.second));
+		};
+		take(segmentSamples);
+		take(frameTable.x);
+		take(frameTable.y);
+		take(frameTable.z);
+		take(frameTable.qx);
+		take(frameTable.qy);
+		take(frameTable.qz);
+		take(frameTable.qw);
+		take(arcLengthTable);
+		take(railVertices);
+		take(railIndices);
+		take(chunks);
+		take(tieParams);
+		take(tieFrames);
+		take(tieTransforms);
+		take(frameTexels);
+		take(segmentLengths);
+
+		create_segments(0.5f);
+		create_sample_params();
+		create_arc_length_sums();
+		create_unit_tie();
+		return true;
+	}
+
+	// Redo the frames of samples [first, last) after their segments changed
+	//   The frames after them are left alone: whatever roll the new frames end up with against the next
+	//   old frame is spread over [first, last) so they join smoothly instead of twisting the rest of the loop
+	void update_frames(int first, int last)
+	{
+		int nSamples = frameTable.size();
+		SplineSamples samples;
+		std::vector<Orientation> orientations(last - first);
+		Orientation ori_prev = first == 0 ? initial_orientation() : frameTable.get(first - 1);
+		for (int k = get_sample_segment(first); k < int(segments.size()) && segmentSampleStart[k] < last; k++) {
+			sample(float(k) + 2.0f, float(k) + 3.0f, segmentSamples[k], samples);
+			for (int j = 0; j < segmentSamples[k]; j++) {
+				Orientation& ori_cur = orientations[segmentSampleStart[k] + j - first];
+				next_frame(ori_prev, glm::vec3(samples.px[j], samples.py[j], samples.pz[j]), glm::vec3(samples.tx[j], samples.ty[j], samples.tz[j]), ori_cur);
+				ori_prev = ori_cur;
+			}
+		}
+
+		//the last sample wraps onto the seed frame, there is no old frame to meet
+		if (last < nSamples) {
+			Orientation next = frameTable.get(last);
+			Orientation join = next;
+			turn_frame(ori_prev, join);
+			float roll = atan2(glm::dot(glm::cross(join.Up, next.Up), next.Front), glm::dot(join.Up, next.Up));
+			if (roll != 0.0f) {
+				for (int i = first; i < last; i++) {
+					Orientation& ori = orientations[i - first];
+					float angle = roll * float(i - first + 1) / float(last - first + 1);
+					ori.Up = glm::normalize(ori.Up * cos(angle) + ori.Right * sin(angle));
+					ori.Right = glm::normalize(glm::cross(ori.Front, ori.Up));
+				}
+			}
+		}
+		for (int i = first; i < last; i++) {
+			frameTable.set(i, orientations[i - first]);
+			orientations[i - first] = frameTable.get(i);
+		}
+
+		if (parameters.gpuExtrusion) {
+			for (int i = first; i < last; i++)
+				pack_frame(frameTable, i, sampleParams[i], &frameTexels[i * FRAME_TEXELS]);
+			glBindBuffer(GL_TEXTURE_BUFFER, frameTBO);
+			glBufferSubData(GL_TEXTURE_BUFFER, first * FRAME_TEXELS * sizeof(glm::vec4), (last - first) * FRAME_TEXELS * sizeof(glm::vec4), &frameTexels[first * FRAME_TEXELS]);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			editUploadBytes += (last - first) * FRAME_TEXELS * sizeof(glm::vec4);
+		}
+		else {
+			for (int i = first; i < last; i++)
+				make_rail_ring(orientations[i - first], (sampleParams[i] - 2.0f) * 10.0f, railOffset, &railVertices[i * RAIL_RING_VERTICES]);
+			glBindBuffer(GL_ARRAY_BUFFER, railVBO);
+			glBufferSubData(GL_ARRAY_BUFFER, first * RAIL_RING_VERTICES * sizeof(Vertex), (last - first) * RAIL_RING_VERTICES * sizeof(Vertex), &railVertices[first * RAIL_RING_VERTICES]);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			editUploadBytes += (last - first) * RAIL_RING_VERTICES * sizeof(Vertex);
+		}
+	}
+
+	// The segment sample i belongs to
+	int get_sample_segment(int i)
+	{
+		return int(std::upper_bound(segmentSampleStart.begin(), segmentSampleStart.end(), i) - segmentSampleStart.begin()) - 1;
+	}
+
+	// The chunk sample i belongs to
+	int chunk_of(int i)
+	{
+		return i / glm::max(parameters.chunkSamples, 1);
+	}
+
+	// Measure the edited segments again, the segments after them only move along by the change in the running sums
+	void update_arc_length_table(const std::vector<int>& edited)
+	{
+		for (int k : edited) {
+			float length = measure_segment(k);
+			segmentDistances.add(k, double(length) - double(segmentLengths[k]));
+			segmentLengths[k] = length;
+		}
+		close_arc_length_table();
+	}
+
+	// Bring the ties up to date after the frames in ranges changed
+	//   The ties sitting on the edit keep their number and are spaced evenly again between the ties either
+	//   side of it, the rest keep their place. Edits across the start of the track place every tie again
+	void update_ties(const std::vector<glm::ivec2>& ranges, const std::vector<bool>& touched)
+	{
+		int nSamples = frameTable.size();
+		int nTies = tieParams.size();
+		int firstTie = 0, lastTie = 0;
+		if (ranges.size() == 1 && ranges[0].x > 0) {
+			float sBegin = sampleParams[ranges[0].x - 1];
+			float sEnd = ranges[0].y < nSamples ? sampleParams[ranges[0].y] : float(controlPoints.size()) + 2.0f;
+			firstTie = std::lower_bound(tieParams.begin(), tieParams.end(), sBegin) - tieParams.begin();
+			lastTie = std::lower_bound(tieParams.begin(), tieParams.end(), sEnd) - tieParams.begin();
 		}
+		if (firstTie == 0 || lastTie >= nTies) {
+			create_ties();
+			upload_ties();
+			editUploadBytes += tieParams.size() * (parameters.gpuExtrusion ? sizeof(float) : sizeof(glm::mat4));
+			return;
+		}
+
+		float dBegin = get_distance(tieParams[firstTie - 1]);
+		float dEnd = get_distance(tieParams[lastTie]);
+		for (int t = firstTie; t < lastTie; t++) {
+			tieParams[t] = get_param(dBegin + (dEnd - dBegin) * float(t - firstTie + 1) / float(lastTie - firstTie + 1));
+			place_tie(t);
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, tieInstanceVBO);
+		if (parameters.gpuExtrusion)
+			glBufferSubData(GL_ARRAY_BUFFER, firstTie * sizeof(float), (lastTie - firstTie) * sizeof(float), &tieFrames[firstTie]);
+		else
+			glBufferSubData(GL_ARRAY_BUFFER, firstTie * sizeof(glm::mat4), (lastTie - firstTie) * sizeof(glm::mat4), &tieTransforms[firstTie]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		editUploadBytes += (lastTie - firstTie) * (parameters.gpuExtrusion ? sizeof(float) : sizeof(glm::mat4));
+
+		for (int c = 0; c < int(chunks.size()); c++) {
+			if (touched[c])
+				assign_ties(c, c + 1);
+		}
+	}
+
+	// Find the highest sample of the track, chunk by chunk
+	void measure_height()
+	{
+		std::vector<float> heights(chunks.size());
+		for (size_t c = 0; c < chunks.size(); c++)
+			heights[c] = chunk_height(chunks[c]);
+		chunkHeights.assign(heights);
+		hmax = chunkHeights.highest();
 	}
 
-	// Given 3 Points, create a triangle and push it into Vertices (and EBO if you are using one)
-	// Optional boolean to flip the normal if you need to
-	// Note that if you're using an EBO, you may want to use a different approach than making
-	// new Vertices every time, you may need to access existing Vertices
-	//object tells which vertex array to add to
-	//placeTie tells when to add to tie vertices
-	void make_triangle(glm::vec3 posA, glm::vec3 posB, glm::vec3 posC, glm::vec2 textureA, glm::vec2 textureB, glm::vec2 textureC, bool flipNormal, std::string object, bool placeTie)
+	// Highest sample of a chunk
+	float chunk_height(const TrackChunk& chunk)
 	{
-		Vertex vA;
-		Vertex vB;
-		Vertex vC;
+		const float* y = frameTable.y.data() + chunk.firstSample;
+		return chunk.sampleCount > 0 ? *std::max_element(y, y + chunk.sampleCount) : -FLT_MAX;
+	}
 
-		vA.Position = posA;
-		vB.Position = posB;
-		vC.Position = posC;
+	// Place a tie every tieSpacing along the track
+	//   The unit tie spans [-1,1] across, [-1,0] up and [0,1] forward, the transform
+	//   scales it to the tie size and lines it up with the orientation at that point
+	void create_ties()
+	{
+		int nTies = int(trackLength / tieSpacing);
+		tieParams.resize(nTies);
+		tieFrames.resize(nTies);
+		tieTransforms.resize(nTies);
+		for (int t = 0; t < nTies; t++) {
+			tieParams[t] = get_param(t * tieSpacing);
+			place_tie(t);
+		}
 
-		set_normals(vA, vB, vC, flipNormal);
+		assign_ties(0, chunks.size());
+	}
 
-		vA.TexCoords = textureA;
-		vB.TexCoords = textureB;
-		vC.TexCoords = textureC;
+	// Work out the frame position and transform of tie t from its s
+	void place_tie(int t)
+	{
+		tieFrames[t] = get_frame(tieParams[t]);
+		tieTransforms[t] = make_tie_transform(get_orientation(tieParams[t]), railOffset, tieOffset);
+	}
 
-		if (object == "right rail") {
-			rightRailVertices.push_back(vA);
-			rightRailVertices.push_back(vB);
-			rightRailVertices.push_back(vC);
+	// Hand the ties to chunks [firstChunk, lastChunk) and bound them, both are in track order
+	void assign_ties(int firstChunk, int lastChunk)
+	{
+		for (int c = firstChunk; c < lastChunk; c++) {
+			TrackChunk& chunk = chunks[c];
+			float sBegin = c == 0 ? 0.0f : sampleParams[chunk.firstSample];
+			float sEnd = c + 1 < int(chunks.size()) ? sampleParams[chunks[c + 1].firstSample] : float(controlPoints.size()) + 2.0f;
+			chunk.firstTie = std::lower_bound(tieParams.begin(), tieParams.end(), sBegin) - tieParams.begin();
+			chunk.tieCount = (std::lower_bound(tieParams.begin(), tieParams.end(), sEnd) - tieParams.begin()) - chunk.firstTie;
+
+			chunk.bounds = chunk.railBounds;
+			for (int tie = chunk.firstTie; tie < chunk.firstTie + chunk.tieCount; tie++) {
+				for (int corner = 0; corner < 8; corner++) {
+					glm::vec4 p(corner & 1 ? 1.0f : -1.0f, corner & 2 ? -1.0f : 0.0f, corner & 4 ? 1.0f : 0.0f, 1.0f);
+					chunk.bounds.expand(glm::vec3(tieTransforms[tie] * p));
+				}
+			}
 		}
-		if (object == "left rail") {
-			leftRailVertices.push_back(vA);
-			leftRailVertices.push_back(vB);
-			leftRailVertices.push_back(vC);
+	}
+
+	// Split the samples into chunks, bound their rails and build the coarser levels of detail
+	//   Every level of a chunk starts and ends on the same rings as the full mesh, so neighbouring chunks
+	//   at different levels still meet without cracks. The coarser levels are appended after the full mesh in railIndices,
+	//   with GPU extrusion there are no indices and only the counts are kept
+	void create_chunks()
+	{
+		int nSamples = frameTable.size();
+		int chunkSamples = glm::max(parameters.chunkSamples, 1);
+		chunks.clear();
+		for (int first = 0; first < nSamples; first += chunkSamples) {
+			TrackChunk chunk;
+			chunk.firstSample = first;
+			chunk.sampleCount = glm::min(chunkSamples, nSamples - first);
+			chunk.firstTie = 0;
+			chunk.tieCount = 0;
+			chunk.lod = 0;
+			bound_chunk(chunk);
+			chunk.bounds = chunk.railBounds;
+
+			//the full mesh is already in place
+			chunk.lodFirstIndex[0] = first * RAIL_SEGMENT_INDICES;
+			chunk.lodIndexCount[0] = chunk.sampleCount * RAIL_SEGMENT_INDICES;
+			chunk.lodError[0] = 0.0f;
+			chunks.push_back(chunk);
 		}
-		if (object == "tie") {
-			tieVertices.push_back(vA);
-			tieVertices.push_back(vB);
-			tieVertices.push_back(vC);
+
+		for (int level = 1; level < TRACK_LOD_LEVELS; level++) {
+			int stride = 1 << level;
+			bool simple = level == TRACK_LOD_LEVELS - 1;
+			int segmentIndices = simple ? RAIL_SIMPLE_SEGMENT_INDICES : RAIL_SEGMENT_INDICES;
+			for (TrackChunk& chunk : chunks) {
+				if (parameters.gpuExtrusion) {
+					chunk.lodFirstIndex[level] = 0;
+					chunk.lodIndexCount[level] = (chunk.sampleCount + stride - 1) / stride * segmentIndices;
+					continue;
+				}
+				chunk.lodFirstIndex[level] = railIndices.size();
+
+				int end = chunk.firstSample + chunk.sampleCount;
+				for (int a = chunk.firstSample; a < end; a += stride) {
+					int b = glm::min(a + stride, end);
+					unsigned int indices[RAIL_SEGMENT_INDICES];
+					make_rail_indices(a * RAIL_RING_VERTICES, (b % nSamples) * RAIL_RING_VERTICES, indices, simple);
+					railIndices.insert(railIndices.end(), indices, indices + segmentIndices);
+				}
+				chunk.lodIndexCount[level] = railIndices.size() - chunk.lodFirstIndex[level];
+			}
 		}
+
+		for (TrackChunk& chunk : chunks)
+			measure_chunk_lod(chunk);
 	}
 
-	// Given two orientations, create the rail between them. Offset can be useful if you want to call this for multiple rails
-	void makeRailPart(Orientation ori_prev, Orientation ori_cur, glm::vec3 railOffset, glm::vec3 tieOffset, bool placeTie)
+	// Bound the rails of a chunk, including the ring it joins into
+	void bound_chunk(TrackChunk& chunk)
 	{
-		glm::vec3 posA;
-		glm::vec3 posB;
-		glm::vec3 posC;
-		glm::vec2 textureA;
-		glm::vec2 textureB;
-		glm::vec2 textureC;
+		int nSamples = frameTable.size();
+		chunk.railBounds = AABB();
+		for (int i = chunk.firstSample; i <= chunk.firstSample + chunk.sampleCount; i++) {
+			if (railVertices.empty()) {
+				//no rings on the CPU with GPU extrusion, box the frame origin by the reach of the rails instead
+				glm::vec3 reach = glm::vec3(0.1f) + 2.0f * railOffset;
+				chunk.railBounds.expand(frameTable.origin(i % nSamples) - reach);
+				chunk.railBounds.expand(frameTable.origin(i % nSamples) + reach);
+				continue;
+			}
+			const Vertex* ring = &railVertices[(i % nSamples) * RAIL_RING_VERTICES];
+			for (int v = 0; v < RAIL_RING_VERTICES; v++)
+				chunk.railBounds.expand(ring[v].Position);
+		}
+	}
 
-		std::string railType = "right rail"; //string to tell make triangle to add to left or right rail verticies
-		glm::vec3 leftRightOffset = glm::vec3(0.1f, 0.1f, 0.1f); //offset multiplier to reduce distance of rails from the origin
+	// How far each level of detail of a chunk can stray from the full mesh
+	void measure_chunk_lod(TrackChunk& chunk)
+	{
+		int nSamples = frameTable.size();
+		chunk.lodError[0] = 0.0f;
+		for (int level = 1; level < TRACK_LOD_LEVELS; level++) {
+			int stride = 1 << level;
+
+			//how far the skipped samples sit from the straight spans that replace them
+			float error = 0.0f;
+			int end = chunk.firstSample + chunk.sampleCount;
+			for (int a = chunk.firstSample; a < end; a += stride) {
+				int b = glm::min(a + stride, end);
+				glm::vec3 start = frameTable.origin(a);
+				glm::vec3 span = frameTable.origin(b % nSamples) - start;
+				for (int i = a + 1; i < b; i++) {
+					glm::vec3 offset = frameTable.origin(i) - start;
+					float along = glm::clamp(glm::dot(offset, span) / glm::max(glm::dot(span, span), 1e-12f), 0.0f, 1.0f);
+					error = glm::max(error, glm::distance(offset, along * span));
+				}
+			}
+
+			//each dropped tie loses a feature as deep as a tie, and the simple profile loses the rail bottoms
+			error = glm::max(error, railOffset.z * float(stride - 1));
+			if (level == TRACK_LOD_LEVELS - 1)
+				error = glm::max(error, 2.0f * railOffset.y);
+			chunk.lodError[level] = glm::max(error, chunk.lodError[level - 1]);
+		}
+	}
 
-		//first loop adds right rail vertices and second loop adds left rail vertices
-		for (int railNum = 1; railNum <= 2; railNum++) {
+	// Point the instance attributes at every stride th tie starting from firstTie,
+	//   a mat4 in locations 3 to 6, or with GPU extrusion a single frame position in location 3
+	//   GL 3.3 has no base instance for instanced draws, so the attribute offset does the job
+	void point_tie_instances(int firstTie, int stride = 1)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, tieInstanceVBO);
+		if (parameters.gpuExtrusion) {
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride * sizeof(float), (void*)(firstTie * sizeof(float)));
+			glVertexAttribDivisor(3, 1);
+			return;
+		}
+		for (int column = 0; column < 4; column++) {
+			glEnableVertexAttribArray(3 + column);
+			glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, stride * sizeof(glm::mat4), (void*)(firstTie * sizeof(glm::mat4) + column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(3 + column, 1);
+		}
+	}
 
-			if (railType == "left rail") {
-				leftRightOffset = glm::vec3(-0.1f, -0.1f, -0.1f);}
+	// Upload the per tie data the tie shader reads
+	void upload_ties()
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, tieInstanceVBO);
+		if (parameters.gpuExtrusion)
+			glBufferData(GL_ARRAY_BUFFER, tieFrames.size() * sizeof(float), tieFrames.data(), GL_STATIC_DRAW);
+		else
+			glBufferData(GL_ARRAY_BUFFER, tieTransforms.size() * sizeof(glm::mat4), tieTransforms.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-			//calculate triangle vertices and texture coordinates for the rails
-			//rail top
-				//trianlge1
-				posA = ori_prev.origin + ori_prev.Up * railOffset - ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_prev.origin + ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posC = ori_cur.origin + ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 0.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, railType, placeTie);
-				//triangle2
-				posA = ori_prev.origin + ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_cur.origin + ori_cur.Up * railOffset + ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				posC = ori_cur.origin + ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(1.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, railType, placeTie);
+	// Walk each segment in small steps and record the distance travelled into it at each step
+	//   The running sums of the segment lengths give the distance to the start of each segment
+	void create_arc_length_table()
+	{
+		int n = controlPoints.size();
+		arcLengthTable.resize(n * ARC_LENGTH_SUBDIVISIONS + 1);
+		segmentLengths.resize(n);
+		for (int k = 0; k < n; k++)
+			segmentLengths[k] = measure_segment(k);
+		create_arc_length_sums();
+	}
 
-			//rail bottom
-				//trianlge1
-				posA = ori_prev.origin - ori_prev.Up * railOffset - ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_prev.origin - ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posC = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 0.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, railType, placeTie);
-				//triangle2
-				posA = ori_prev.origin - ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				posC = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(1.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, railType, placeTie);
+	// Fill the table entries of segment k and give its length
+	float measure_segment(int k)
+	{
+		int n = controlPoints.size();
+		SplineSamples samples;
+		sample(float(k) + 2.0f, float(k) + 3.0f, ARC_LENGTH_SUBDIVISIONS, samples);
+
+		ArcLengthSample* entry = &arcLengthTable[k * ARC_LENGTH_SUBDIVISIONS];
+		float distance = 0.0f;
+		glm::vec3 prev(samples.px[0], samples.py[0], samples.pz[0]);
+		for (int j = 0; j < ARC_LENGTH_SUBDIVISIONS; j++) {
+			glm::vec3 cur(samples.px[j], samples.py[j], samples.pz[j]);
+			distance += glm::distance(prev, cur);
+			entry[j] = { distance, k, float(j) / float(ARC_LENGTH_SUBDIVISIONS) };
+			prev = cur;
+		}
+		//the segment ends where the next one starts
+		return distance + glm::distance(prev, segments[(k + 1) % n].a);
+	}
 
-			//rail left
-				//trianlge1
-				posA = ori_prev.origin + ori_prev.Up * railOffset - ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_prev.origin - ori_prev.Up * railOffset - ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posC = ori_cur.origin + ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 0.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, railType, placeTie);
-				//triangle2
-				posA = ori_prev.origin - ori_prev.Up * railOffset - ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				posC = ori_cur.origin + ori_cur.Up * railOffset - ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(1.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, railType, placeTie);
+	// Sum the segment lengths up again after they were all set
+	void create_arc_length_sums()
+	{
+		segmentDistances.assign(segmentLengths);
+		close_arc_length_table();
+	}
 
-			//rail right
-				//trianlge1
-				posA = ori_prev.origin + ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_prev.origin - ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posC = ori_cur.origin + ori_cur.Up * railOffset + ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 0.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, railType, placeTie);
-				//triangle2
-				posA = ori_prev.origin - ori_prev.Up * railOffset + ori_prev.Right * railOffset + ori_prev.Right * leftRightOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				posC = ori_cur.origin + ori_cur.Up * railOffset + ori_cur.Right * railOffset + ori_cur.Right * leftRightOffset;
-				textureA = glm::vec2(1.0f, 0.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(0.0f, 1.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, railType, placeTie);
-			
-			railType = "left rail";
-		}
-
-		if (placeTie == true) {
-			//calculate triangles vertices and texture coordinates for the ties
-			//tie top
-				//triangle1
-				posA = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(0.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, "tie", placeTie);
-
-				//triangle2
-				posA = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, "tie", placeTie);
-
-			//tie bottom
-				//triangle1
-				posA = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(0.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, "tie", placeTie);
-
-				//triangle2
-				posA = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posB = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, "tie", placeTie);
-
-			//tie right
-				//triangle1
-				posA = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(0.0f, 0.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, "tie", placeTie);
-
-				//triangle2
-				posA = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, "tie", placeTie);
-
-			//tie left
-				//triangle1
-				posA = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(0.0f, 0.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, "tie", placeTie);
-
-				//triangle2
-				posA = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, "tie", placeTie);
-
-			//tie front
-				//triangle1
-				posA = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, "tie", placeTie);
-
-				//triangle2
-				posA = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset + ori_cur.Front * railOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(0.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, false, "tie", placeTie);
-
-			//tie back
-				//triangle1
-				posA = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset + ori_cur.Right * tieOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset;
-				textureA = glm::vec2(0.0f, 1.0f);
-				textureB = glm::vec2(1.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, "tie", placeTie);
-
-				//triangle2
-				posA = ori_cur.origin - ori_cur.Up * 0.05f - ori_cur.Right * tieOffset;
-				posB = ori_cur.origin - ori_cur.Up * railOffset - ori_cur.Right * tieOffset;
-				posC = ori_cur.origin - ori_cur.Up * 0.05f + ori_cur.Right * tieOffset;
-				textureA = glm::vec2(0.0f, 0.0f);
-				textureB = glm::vec2(0.0f, 1.0f);
-				textureC = glm::vec2(1.0f, 0.0f);
-				make_triangle(posA, posB, posC, textureA, textureB, textureC, true, "tie", placeTie);
-		}
-	}
-
-	// Find the normal for each triangle uisng the cross product and then add it to all three Vertices of the triangle.  
-	//   The normalization of all the triangles happens in the shader which averages all norms of adjacent triangles.   
-	//   Order of the triangles matters here since you want to normal facing out of the object.  
-	void set_normals(Vertex& p1, Vertex& p2, Vertex& p3, bool flipNormal)
-	{
-		glm::vec3 normal = glm::cross(p2.Position - p1.Position, p3.Position - p1.Position);
-		if (flipNormal == true) {
-			normal = -normal;
-		}
-		p1.Normal += normal;
-		p2.Normal += normal;
-		p3.Normal += normal;
+	// The entry closing the loop at the end of the last segment, and the length of the track
+	void close_arc_length_table()
+	{
+		int n = controlPoints.size();
+		arcLengthTable[n * ARC_LENGTH_SUBDIVISIONS] = { segmentLengths[n - 1], n - 1, 1.0f };
+		trackLength = segmentDistances.total();
 	}
 
-	void setup_track()
+	// The arc length table with distances from the start of the track, as track files store it
+	void get_track_arc_length_table(std::vector<ArcLengthSample>& out)
 	{
-		//generate and bind VAO and VBO for right rail
-		glGenVertexArrays(1, &rightRailVAO);
-		glGenBuffers(1, &rightRailVBO);
+		int n = controlPoints.size();
+		out = arcLengthTable;
+		double start = 0.0;
+		for (int k = 0; k < n; k++) {
+			for (int j = 0; j < ARC_LENGTH_SUBDIVISIONS; j++)
+				out[k * ARC_LENGTH_SUBDIVISIONS + j].distance = float(start + arcLengthTable[k * ARC_LENGTH_SUBDIVISIONS + j].distance);
+			start += segmentLengths[k];
+		}
+		out[n * ARC_LENGTH_SUBDIVISIONS].distance = float(start);
+	}
 
-		glBindVertexArray(rightRailVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, rightRailVBO);
-		glBufferData(GL_ARRAY_BUFFER, rightRailVertices.size() * sizeof(Vertex), &rightRailVertices[0], GL_STATIC_DRAW);
+	// Take an arc length table with distances from the start of the track, as track files store it
+	void set_track_arc_length_table(const ArcLengthSample* table, size_t count)
+	{
+		int n = controlPoints.size();
+		arcLengthTable.assign(table, table + count);
+		segmentLengths.resize(n);
+		for (int k = 0; k < n; k++) {
+			float start = table[k * ARC_LENGTH_SUBDIVISIONS].distance;
+			for (int j = 0; j < ARC_LENGTH_SUBDIVISIONS; j++)
+				arcLengthTable[k * ARC_LENGTH_SUBDIVISIONS + j].distance -= start;
+			segmentLengths[k] = table[(k + 1) * ARC_LENGTH_SUBDIVISIONS].distance - start;
+		}
+		create_arc_length_sums();
+	}
 
-		//positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	// Write one vertex of the track geometry
+	static void make_vertex(Vertex& v, glm::vec3 position, glm::vec3 normal, glm::vec2 texture)
+	{
+		v.Position = position;
+		v.Normal = normal;
+		v.TexCoords = texture;
+	}
 
-		//normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+	// Given an orientation, make the cross section of both rails at that point
+	//   Every face of the box profile gets its own pair of vertices so the normals stay flat,
+	//   but the pair is shared with the segment before and after it.
+	//   The texture runs across the face in u and along the track in v, repeating every sample
+	//   Layout per rail: top, bottom, left, right face, 2 vertices each
+	static void make_rail_ring(const Orientation& ori, float v, glm::vec3 railOffset, Vertex* out)
+	{
+		glm::vec3 leftRightOffset = glm::vec3(0.1f, 0.1f, 0.1f); //offset multiplier to reduce distance of rails from the origin
 
-		//textures
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		//first pass makes the right rail and second pass makes the left rail
+		for (int railNum = 0; railNum < 2; railNum++) {
+			glm::vec3 center = ori.origin + ori.Right * leftRightOffset;
+			glm::vec3 topLeft = center + ori.Up * railOffset - ori.Right * railOffset;
+			glm::vec3 topRight = center + ori.Up * railOffset + ori.Right * railOffset;
+			glm::vec3 bottomLeft = center - ori.Up * railOffset - ori.Right * railOffset;
+			glm::vec3 bottomRight = center - ori.Up * railOffset + ori.Right * railOffset;
+
+			Vertex* rail = out + railNum * 8;
+			//rail top
+			make_vertex(rail[0], topLeft, ori.Up, glm::vec2(0.0f, v));
+			make_vertex(rail[1], topRight, ori.Up, glm::vec2(1.0f, v));
+			//rail bottom
+			make_vertex(rail[2], bottomLeft, -ori.Up, glm::vec2(0.0f, v));
+			make_vertex(rail[3], bottomRight, -ori.Up, glm::vec2(1.0f, v));
+			//rail left
+			make_vertex(rail[4], topLeft, -ori.Right, glm::vec2(0.0f, v));
+			make_vertex(rail[5], bottomLeft, -ori.Right, glm::vec2(1.0f, v));
+			//rail right
+			make_vertex(rail[6], topRight, ori.Right, glm::vec2(0.0f, v));
+			make_vertex(rail[7], bottomRight, ori.Right, glm::vec2(1.0f, v));
+
+			leftRightOffset = glm::vec3(-0.1f, -0.1f, -0.1f);
+		}
+	}
 
+	// Given the first vertex of two rings, make the triangles for both rails between them
+	//   the simple profile leaves out the bottom faces
+	static void make_rail_indices(unsigned int ring, unsigned int nextRing, unsigned int* out, bool simple = false)
+	{
+		//each face is a quad between its vertex pair on this ring and on the next
+		for (unsigned int face = 0; face < 8; face++) {
+			if (simple && face % 4 == 1)
+				continue;
+
+			unsigned int a0 = ring + face * 2;
+			unsigned int a1 = a0 + 1;
+			unsigned int b0 = nextRing + face * 2;
+			unsigned int b1 = b0 + 1;
+
+			//the bottom and left faces have their vertex pair the other way round, flip them to face outwards
+			bool flip = (face % 4 == 1) || (face % 4 == 2);
+
+			//triangle1
+			*out++ = a0;
+			*out++ = flip ? b0 : a1;
+			*out++ = flip ? a1 : b0;
+			//triangle2
+			*out++ = a1;
+			*out++ = flip ? b0 : b1;
+			*out++ = flip ? b1 : b0;
+		}
+	}
 
-		//generate and bind VAO and VBO for left rail
-		glGenVertexArrays(1, &leftRailVAO);
-		glGenBuffers(1, &leftRailVBO);
+	// Make the unit tie box, 4 vertices per face
+	//   Right, Up, Front is a left handed frame so the transform mirrors the box, the faces are wound to come out right after it
+	static void make_unit_tie(Vertex* out, unsigned int* indices)
+	{
+		glm::vec3 top = glm::vec3(0.0f, 0.0f, 0.0f);
+		glm::vec3 bottom = glm::vec3(0.0f, -1.0f, 0.0f);
+		glm::vec3 left = glm::vec3(-1.0f, 0.0f, 0.0f);
+		glm::vec3 right = glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 front = glm::vec3(0.0f, 0.0f, 1.0f);
+
+		glm::vec3 corners[6][4] = {
+			{ top + left, top + right, top + right + front, top + left + front },					//tie top
+			{ bottom + left, bottom + left + front, bottom + right + front, bottom + right },		//tie bottom
+			{ top + right, bottom + right, bottom + right + front, top + right + front },			//tie right
+			{ top + left, top + left + front, bottom + left + front, bottom + left },				//tie left
+			{ top + left + front, top + right + front, bottom + right + front, bottom + left + front },	//tie front
+			{ top + left, bottom + left, bottom + right, top + right }								//tie back
+		};
+		glm::vec3 normals[6] = { glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), right, left, front, -front };
+		glm::vec2 textures[4] = { glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 1.0f) };
+
+		for (unsigned int face = 0; face < 6; face++) {
+			for (int corner = 0; corner < 4; corner++)
+				make_vertex(out[face * 4 + corner], corners[face][corner], normals[face], textures[corner]);
+
+			unsigned int base = face * 4;
+			*indices++ = base;
+			*indices++ = base + 1;
+			*indices++ = base + 2;
+			*indices++ = base;
+			*indices++ = base + 2;
+			*indices++ = base + 3;
+		}
+	}
 
-		glBindVertexArray(leftRailVAO);
-		glBindBuffer(GL_ARRAY_BUFFER, leftRailVBO);
-		glBufferData(GL_ARRAY_BUFFER, leftRailVertices.size() * sizeof(Vertex), &leftRailVertices[0], GL_STATIC_DRAW);
+	void setup_track()
+	{
+		//generate and bind VAO, VBO and EBO for the rails
+		glGenVertexArrays(1, &railVAO);
+		glGenBuffers(1, &railVBO);
+		glGenBuffers(1, &railEBO);
+
+		glBindVertexArray(railVAO);
+		if (parameters.gpuExtrusion) {
+			//no vertex attributes or indices, railExtrude.vert reads the frames from the buffer texture by gl_VertexID
+			glGenBuffers(1, &frameTBO);
+			glGenTextures(1, &frameTexture);
+			upload_frames();
+			glBindTexture(GL_TEXTURE_BUFFER, frameTexture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, frameTBO);
+			glBindTexture(GL_TEXTURE_BUFFER, 0);
+		}
+		else {
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, railEBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, railIndices.size() * sizeof(unsigned int), &railIndices[0], GL_STATIC_DRAW);
 
-		//positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+			glBindBuffer(GL_ARRAY_BUFFER, railVBO);
+			glBufferData(GL_ARRAY_BUFFER, railVertices.size() * sizeof(Vertex), &railVertices[0], GL_STATIC_DRAW);
 
-		//normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+			//positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
 
-		//textures
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+			//normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+			//textures
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+		}
 
 
-		//generate and bind VAO and VBO for ties
+		//generate and bind VAO, VBO and EBO for ties
 		glGenVertexArrays(1, &tieVAO);
 		glGenBuffers(1, &tieVBO);
+		glGenBuffers(1, &tieEBO);
 
 		glBindVertexArray(tieVAO);
 		glBindBuffer(GL_ARRAY_BUFFER, tieVBO);
 		glBufferData(GL_ARRAY_BUFFER, tieVertices.size() * sizeof(Vertex), &tieVertices[0], GL_STATIC_DRAW);
 
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, tieEBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, tieIndices.size() * sizeof(unsigned int), &tieIndices[0], GL_STATIC_DRAW);
+
 		//positions
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
@@ -568,6 +1858,11 @@ private:
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
 
+		//per tie data, a transform or with GPU extrusion a frame position
+		glGenBuffers(1, &tieInstanceVBO);
+		upload_ties();
+		point_tie_instances(0);
+
 		glBindVertexArray(0);
 	}
 
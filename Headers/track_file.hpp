@@ -0,0 +1,349 @@
+#pragma once
+
+// Compiled binary track files (.spb)
+//   A header followed by flat arrays that can be used straight from a memory mapping:
+//     control points      3 floats each, already added up into positions
+//     segment samples     1 int per segment                    (with frames)
+//     frames              7 arrays of a float per sample: x y z, qx qy qz qw (with frames)
+//     arc length table    distance, segment, u per entry        (with frames)
+//   Everything is little-endian and every array starts on a 16 byte boundary.
+//   The frames depend on how the track was tessellated, so the settings used are stored with them
+
+#include <glm/glm.hpp>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <rc_spline.h>
+
+const char TRACK_FILE_MAGIC[4] = { 'R', 'C', 'T', 'B' };
+const uint32_t TRACK_FILE_VERSION = 2;
+// written as a native integer, reads back differently on a big-endian machine
+const uint32_t TRACK_FILE_BYTE_ORDER = 0x01020304;
+// the file holds segment samples, frames and the arc length table
+const uint32_t TRACK_FILE_FRAMES = 1;
+// frames are stored as an origin and a quaternion, an array per component like FrameTable
+const int TRACK_FILE_FRAME_ARRAYS = 7;
+
+struct TrackFileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t flags;
+	uint32_t nControlPoints;
+	uint32_t nSamples;
+	uint32_t nArcLength;
+	// tessellation the frames were built with
+	uint32_t adaptive;
+	int32_t subdivisions;
+	float tolerance;
+	int32_t maxSubdivisions;
+	uint32_t reserved;
+	// byte offsets of the arrays from the start of the file
+	uint64_t controlPointsOffset;
+	uint64_t segmentSamplesOffset;
+	uint64_t framesOffset;
+	uint64_t arcLengthOffset;
+};
+
+// Read only view of a whole file through the OS page cache, nothing is read until it is touched
+class MappedFile
+{
+public:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+
+	MappedFile(const std::string& path)
+	{
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+			return;
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data)
+			size = size_t(length.QuadPart);
+#else
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			void* view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (view != MAP_FAILED) {
+				data = (const unsigned char*)view;
+				size = info.st_size;
+			}
+		}
+		//kept open to tell the page cache which parts of the file are no longer needed
+		descriptor = fd;
+#endif
+	}
+
+	~MappedFile()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data)
+			munmap((void*)data, size);
+		if (descriptor >= 0)
+			close(descriptor);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Let go of the pages holding bytes [begin, begin + bytes) of the mapping once they have been read
+	//   The range is widened to whole pages of this machine, so pages shared with the bytes either side go too and
+	//   are read again from the file if touched. They are unmapped from the process and, where the OS offers
+	//   posix_fadvise, dropped from the page cache as well. Windows keeps them until the OS needs the memory
+	void drop_pages(const unsigned char* begin, size_t bytes) const
+	{
+#ifndef _WIN32
+		if (data == nullptr || bytes == 0)
+			return;
+		size_t page = size_t(sysconf(_SC_PAGESIZE));
+		size_t first = size_t(begin - data) / page * page;
+		size_t last = size_t(begin - data) + bytes;
+		if (last > size)
+			last = size;
+		madvise((void*)(data + first), last - first, MADV_DONTNEED);
+#ifdef POSIX_FADV_DONTNEED
+		posix_fadvise(descriptor, off_t(first), off_t(last - first), POSIX_FADV_DONTNEED);
+#endif
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int descriptor = -1;
+#endif
+};
+
+// Pointers into a mapped track file, valid while the MappedFile is
+struct TrackFileView {
+	const TrackFileHeader* header = nullptr;
+	const float* controlPoints = nullptr;
+	const int32_t* segmentSamples = nullptr;
+	const float* frames = nullptr;
+	const unsigned char* arcLength = nullptr;
+};
+
+// Check the header and that every array lies inside the file, false means it is not a track file this build can read
+inline bool read_track_file(const MappedFile& file, TrackFileView& view)
+{
+	if (file.size < sizeof(TrackFileHeader))
+		return false;
+	const TrackFileHeader* header = (const TrackFileHeader*)file.data;
+	if (std::memcmp(header->magic, TRACK_FILE_MAGIC, 4) != 0 || header->version != TRACK_FILE_VERSION || header->byteOrder != TRACK_FILE_BYTE_ORDER)
+		return false;
+
+	auto inside = [&](uint64_t offset, uint64_t bytes) { return offset % 16 == 0 && offset <= file.size && bytes <= file.size - offset; };
+	if (!inside(header->controlPointsOffset, uint64_t(header->nControlPoints) * 3 * sizeof(float)))
+		return false;
+	view.header = header;
+	view.controlPoints = (const float*)(file.data + header->controlPointsOffset);
+
+	if (header->flags & TRACK_FILE_FRAMES) {
+		if (!inside(header->segmentSamplesOffset, uint64_t(header->nControlPoints) * sizeof(int32_t)) ||
+			!inside(header->framesOffset, uint64_t(header->nSamples) * TRACK_FILE_FRAME_ARRAYS * sizeof(float)) ||
+			!inside(header->arcLengthOffset, uint64_t(header->nArcLength) * 3 * sizeof(float)))
+			return false;
+		view.segmentSamples = (const int32_t*)(file.data + header->segmentSamplesOffset);
+		view.frames = (const float*)(file.data + header->framesOffset);
+		view.arcLength = file.data + header->arcLengthOffset;
+	}
+	return true;
+}
+
+// Write a track file, the frame arrays are left out when frames is null
+//   frames points at the TRACK_FILE_FRAME_ARRAYS arrays of nSamples floats, arcLength holds nArcLength entries
+//   of a float distance, an int segment and a float u
+inline bool write_track_file(const std::string& path, TrackFileHeader header, const float* controlPoints,
+	const int32_t* segmentSamples, const float* const* frames, const void* arcLength)
+{
+	std::memcpy(header.magic, TRACK_FILE_MAGIC, 4);
+	header.version = TRACK_FILE_VERSION;
+	header.byteOrder = TRACK_FILE_BYTE_ORDER;
+	header.flags = frames ? TRACK_FILE_FRAMES : 0;
+	header.reserved = 0;
+
+	auto align = [](uint64_t offset) { return (offset + 15) & ~uint64_t(15); };
+	header.controlPointsOffset = align(sizeof(TrackFileHeader));
+	header.segmentSamplesOffset = align(header.controlPointsOffset + uint64_t(header.nControlPoints) * 3 * sizeof(float));
+	header.framesOffset = align(header.segmentSamplesOffset + (frames ? uint64_t(header.nControlPoints) * sizeof(int32_t) : 0));
+	header.arcLengthOffset = align(header.framesOffset + (frames ? uint64_t(header.nSamples) * TRACK_FILE_FRAME_ARRAYS * sizeof(float) : 0));
+	if (!frames) {
+		header.nSamples = 0;
+		header.nArcLength = 0;
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+
+	const char padding[16] = {};
+	uint64_t written = 0;
+	auto put = [&](uint64_t offset, const void* data, uint64_t bytes) {
+		fwrite(padding, 1, size_t(offset - written), file);
+		fwrite(data, 1, size_t(bytes), file);
+		written = offset + bytes;
+	};
+	put(0, &header, sizeof(header));
+	put(header.controlPointsOffset, controlPoints, uint64_t(header.nControlPoints) * 3 * sizeof(float));
+	if (frames) {
+		put(header.segmentSamplesOffset, segmentSamples, uint64_t(header.nControlPoints) * sizeof(int32_t));
+		for (int c = 0; c < TRACK_FILE_FRAME_ARRAYS; c++)
+			put(header.framesOffset + uint64_t(c) * header.nSamples * sizeof(float), frames[c], uint64_t(header.nSamples) * sizeof(float));
+		put(header.arcLengthOffset, arcLength, uint64_t(header.nArcLength) * 3 * sizeof(float));
+	}
+
+	bool ok = ferror(file) == 0;
+	ok = fclose(file) == 0 && ok;
+	return ok;
+}
+
+const char MESH_CACHE_MAGIC[4] = { 'R', 'C', 'T', 'M' };
+const uint32_t MESH_CACHE_VERSION = 4;
+const int MESH_CACHE_MAX_SECTIONS = 24;
+
+// Generated track data saved by Track so the next start can skip building it
+//   The key hashes everything the data was built from, a file with another key is a miss
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t nSections;
+	uint64_t key;
+	// byte offset from the start of the file and size of each section
+	uint64_t offset[MESH_CACHE_MAX_SECTIONS];
+	uint64_t bytes[MESH_CACHE_MAX_SECTIONS];
+};
+
+// 64 bit FNV-1a, continue a hash by passing the previous one
+inline uint64_t hash_bytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+// Write sections of (data, bytes), each starting on a 16 byte boundary
+inline bool write_mesh_cache(const std::string& path, uint64_t key, const std::vector<std::pair<const void*, uint64_t>>& sections)
+{
+	if (sections.size() > size_t(MESH_CACHE_MAX_SECTIONS))
+		return false;
+
+	MeshCacheHeader header = {};
+	std::memcpy(header.magic, MESH_CACHE_MAGIC, 4);
+	header.version = MESH_CACHE_VERSION;
+	header.byteOrder = TRACK_FILE_BYTE_ORDER;
+	header.nSections = sections.size();
+	header.key = key;
+	uint64_t offset = sizeof(MeshCacheHeader);
+	for (size_t i = 0; i < sections.size(); i++) {
+		offset = (offset + 15) & ~uint64_t(15);
+		header.offset[i] = offset;
+		header.bytes[i] = sections[i].second;
+		offset += sections[i].second;
+	}
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	const char padding[16] = {};
+	uint64_t written = fwrite(&header, 1, sizeof(header), file);
+	for (size_t i = 0; i < sections.size(); i++) {
+		written += fwrite(padding, 1, size_t(header.offset[i] - written), file);
+		written += fwrite(sections[i].first, 1, size_t(sections[i].second), file);
+	}
+	bool ok = ferror(file) == 0 && written == offset;
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+		std::remove(path.c_str());
+	return ok;
+}
+
+// Find the sections of a mapped cache file, false if it is not a cache for this key or is damaged
+inline bool read_mesh_cache(const MappedFile& file, uint64_t key, std::vector<std::pair<const unsigned char*, uint64_t>>& sections)
+{
+	if (file.size < sizeof(MeshCacheHeader))
+		return false;
+	const MeshCacheHeader* header = (const MeshCacheHeader*)file.data;
+	if (std::memcmp(header->magic, MESH_CACHE_MAGIC, 4) != 0 || header->version != MESH_CACHE_VERSION ||
+		header->byteOrder != TRACK_FILE_BYTE_ORDER || header->key != key || header->nSections > uint32_t(MESH_CACHE_MAX_SECTIONS))
+		return false;
+
+	sections.clear();
+	for (uint32_t i = 0; i < header->nSections; i++) {
+		if (header->offset[i] % 16 != 0 || header->offset[i] > file.size || header->bytes[i] > file.size - header->offset[i])
+			return false;
+		sections.push_back(std::make_pair(file.data + header->offset[i], header->bytes[i]));
+	}
+	return true;
+}
+
+// The compiled file that sits next to a text track, spline/track.sp -> spline/track.spb
+inline std::string binary_track_path(const std::string& trackPath)
+{
+	if (trackPath.size() >= 3 && trackPath.compare(trackPath.size() - 3, 3, ".sp") == 0)
+		return trackPath + "b";
+	return trackPath + ".spb";
+}
+
+// Convert a text track to a binary one holding only the control points, no OpenGL needed
+//   Track::save_binary also stores the frames and arc length table so loading skips building them
+inline bool convert_track_file(const std::string& folder, const std::string& trackPath, const std::string& binaryPath)
+{
+	rc_Spline spline;
+	spline.folder = folder;
+	spline.loadSplineFrom(trackPath);
+
+	std::vector<glm::vec3> controlPoints;
+	glm::vec3 currentpos = glm::vec3(0.0f, 0.0f, 0.0f);
+	for (pointVectorIter ptsiter = spline.points().begin(); ptsiter != spline.points().end(); ptsiter++) {
+		currentpos += *ptsiter;
+		controlPoints.push_back(currentpos);
+	}
+	if (controlPoints.empty())
+		return false;
+
+	TrackFileHeader header = {};
+	header.nControlPoints = controlPoints.size();
+	return write_track_file(folder + binaryPath, header, &controlPoints[0].x, nullptr, nullptr, nullptr);
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+// Building track geometry a window of control points at a time, for tracks too long to hold in memory
+//   Only the current window, the last 3 control points (the Catmull-Rom window into the next one), the first 3
+//   (to close the loop at the end) and the frame carried between chunks are kept. Each window becomes one chunk
+//   of rails and ties that is handed to a sink as soon as it is built, to be written to disk or uploaded
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include <track.hpp>
+
+// One streamed piece of track
+//   The rings start with the last ring of the previous chunk, so every chunk can be drawn on its own
+struct TrackStreamChunk {
+	// sample of the first ring counted from the start of the track, and the rail spans in the chunk
+	long long firstSample;
+	int spanCount;
+	// s and the distance along the track at the first ring, double so very long tracks keep their precision
+	double sBegin;
+	double distance;
+	// length of the chunk along the rail centre line
+	double length;
+	// one frame and one ring per sample, railIndices join ring i to ring i+1
+	std::vector<Orientation> frames;
+	std::vector<Vertex> railVertices;
+	std::vector<unsigned int> railIndices;
+	// unit tie transforms, the same as Track::tieTransforms
+	std::vector<glm::mat4> tieTransforms;
+};
+
+class TrackStreamer
+{
+public:
+	// fills up to max steps between control points and returns how many, 0 at the end of the track
+	typedef std::function<size_t(glm::vec3* steps, size_t max)> Source;
+	// receives each chunk as soon as it is built, the chunk is reused for the next one
+	typedef std::function<void(const TrackStreamChunk& chunk)> Sink;
+
+	TrackParameters parameters;
+	// control points read per window
+	int windowPoints;
+	float tieSpacing = 0.2f;
+	glm::vec3 railOffset = glm::vec3(0.02f, 0.02f, 0.02f);
+	glm::vec3 tieOffset = glm::vec3(0.15f, 0.15f, 0.15f);
+
+	// totals of the last run
+	long long controlPointCount = 0;
+	long long sampleCount = 0;
+	long long tieCount = 0;
+	long long chunkCount = 0;
+	double trackLength = 0.0;
+	// most bytes held in the streamer's buffers at once, it depends on windowPoints and not on the track length
+	size_t workingSetBytes = 0;
+
+	TrackStreamer(TrackParameters trackParameters = TrackParameters(), int window = 4096)
+	{
+		parameters = trackParameters;
+		windowPoints = glm::max(window, 1);
+	}
+
+	// Stream a whole closed track from source into sink, false if it has fewer than 4 control points
+	//   Positions are added up in double, so the error does not grow along tens of millions of steps
+	bool run(const Source& source, const Sink& sink)
+	{
+		controlPointCount = sampleCount = tieCount = chunkCount = 0;
+		trackLength = 0.0;
+		workingSetBytes = 0;
+		points.clear();
+		head.clear();
+		started = false;
+		nextSegment = 0;
+		nextTie = 0.0;
+
+		std::vector<glm::vec3> steps(windowPoints);
+		double position[3] = { 0.0, 0.0, 0.0 };
+		size_t count;
+		while ((count = source(steps.data(), steps.size())) > 0) {
+			for (size_t i = 0; i < count; i++) {
+				for (int k = 0; k < 3; k++)
+					position[k] += steps[i][k];
+				points.push_back(glm::vec3(float(position[0]), float(position[1]), float(position[2])));
+				if (head.size() < 3)
+					head.push_back(points.back());
+			}
+			controlPointCount += count;
+			if (points.size() >= 4)
+				build(sink, false, steps.capacity() * sizeof(glm::vec3));
+		}
+		if (controlPointCount < 4)
+			return false;
+
+		//the last 3 segments run back through the first points to close the loop
+		points.insert(points.end(), head.begin(), head.end());
+		build(sink, true, steps.capacity() * sizeof(glm::vec3));
+		return true;
+	}
+
+	// Stream a text track through rc_Spline a window at a time, the folder is relative like Track's
+	bool run(const std::string& folder, const std::string& trackPath, const Sink& sink)
+	{
+		rc_Spline spline;
+		spline.folder = folder;
+		if (!spline.openStream(trackPath))
+			return false;
+
+		pointVector window;
+		return run([&](glm::vec3* steps, size_t max) {
+			size_t count = spline.readStream(window, max);
+			std::copy(window.begin(), window.end(), steps);
+			return count;
+		}, sink);
+	}
+
+private:
+	// control points still needed, and the first 3 for closing the loop
+	std::vector<glm::vec3> points;
+	std::vector<glm::vec3> head;
+	// per window scratch
+	std::vector<SplineSegment> segments;
+	std::vector<int> counts;
+	std::vector<float> params;
+	std::vector<Orientation> newFrames;
+	SplineSamples samples;
+	TrackStreamChunk chunk;
+	// carried between windows: the last frame and its s, the first frame, the next segment and the next tie distance
+	Orientation lastFrame;
+	double lastS = 0.0;
+	Orientation firstFrame;
+	bool started = false;
+	long long nextSegment = 0;
+	double nextTie = 0.0;
+
+	// Turn the complete segments of the window into a chunk and keep the 3 points the next window needs
+	void build(const Sink& sink, bool closing, size_t sourceBytes)
+	{
+		int nSegments = int(points.size()) - 3;
+		segments.resize(nSegments);
+		counts.resize(nSegments);
+		int total = 0;
+		for (int j = 0; j < nSegments; j++) {
+			segments[j] = Track::make_segment(points[j], points[j + 1], points[j + 2], points[j + 3], 0.5f);
+			counts[j] = parameters.adaptive ? Track::segment_subdivisions(segments[j], parameters, 0.1f + railOffset.x) : parameters.subdivisions;
+			total += counts[j];
+		}
+
+		//sample the window with the same batch kernels as Track::sample_segments, s is local to the window
+		samples.px.resize(total);
+		samples.py.resize(total);
+		samples.pz.resize(total);
+		samples.tx.resize(total);
+		samples.ty.resize(total);
+		samples.tz.resize(total);
+		SplineBatch batch;
+		batch.coefficients = &segments[0].a.x;
+		batch.nSegments = nSegments;
+		int first = 0;
+		for (int j = 0; j < nSegments; j++) {
+			batch.sBegin = float(j) + 2.0f;
+			batch.step = 1.0f / float(counts[j]);
+			batch.position[0] = samples.px.data() + first;
+			batch.position[1] = samples.py.data() + first;
+			batch.position[2] = samples.pz.data() + first;
+			batch.tangent[0] = samples.tx.data() + first;
+			batch.tangent[1] = samples.ty.data() + first;
+			batch.tangent[2] = samples.tz.data() + first;
+			sample_spline(batch, counts[j], best_spline_kernel());
+			first += counts[j];
+		}
+
+		//frames follow on from the last frame of the previous chunk, the first chunk starts like Track does
+		Orientation seed = lastFrame;
+		if (!started) {
+			seed.origin = points[0];
+			seed.Front = glm::vec3(1.0f, 0.0f, 0.0f);
+			seed.Right = glm::vec3(0.0f, 0.0f, 1.0f);
+			seed.Up = glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+		Track::create_frames(samples, total, seed, newFrames);
+
+		//s of every ring, relative to the whole s of the first ring so the texture coordinate keeps its precision
+		double sFirst = started ? lastS : double(nextSegment) + 2.0;
+		double sBase = floor(sFirst);
+		chunk.frames.clear();
+		params.clear();
+		if (started) {
+			chunk.frames.push_back(lastFrame);
+			params.push_back(float(lastS - sBase) + 2.0f);
+		}
+		else
+			firstFrame = newFrames[0];
+		chunk.frames.insert(chunk.frames.end(), newFrames.begin(), newFrames.end());
+		double s = 0.0;
+		for (int j = 0; j < nSegments; j++) {
+			for (int i = 0; i < counts[j]; i++) {
+				s = double(nextSegment + j) + 2.0 + double(i) / double(counts[j]);
+				params.push_back(float(s - sBase) + 2.0f);
+			}
+		}
+		if (closing) {
+			chunk.frames.push_back(firstFrame);
+			params.push_back(float(double(controlPointCount) + 2.0 - sBase) + 2.0f);
+		}
+
+		//the rail mesh joins the last ring back to the first, a chunk is open so that span is dropped
+		Track::create_rail_mesh(chunk.frames, params, railOffset, 1, chunk.railVertices, chunk.railIndices);
+		chunk.railIndices.resize(chunk.railIndices.size() - RAIL_SEGMENT_INDICES);
+
+		//a tie every tieSpacing along the chords between the frames
+		chunk.tieTransforms.clear();
+		double length = 0.0;
+		for (size_t i = 0; i + 1 < chunk.frames.size(); i++) {
+			const Orientation& a = chunk.frames[i];
+			const Orientation& b = chunk.frames[i + 1];
+			double span = glm::distance(a.origin, b.origin);
+			while (nextTie < trackLength + length + span) {
+				float blend = span > 0.0 ? float((nextTie - trackLength - length) / span) : 0.0f;
+				Orientation ori;
+				ori.origin = a.origin * (1.0f - blend) + b.origin * blend;
+				ori.Front = glm::normalize(a.Front * (1.0f - blend) + b.Front * blend);
+				ori.Up = glm::normalize(a.Up * (1.0f - blend) + b.Up * blend);
+				ori.Right = glm::normalize(a.Right * (1.0f - blend) + b.Right * blend);
+				chunk.tieTransforms.push_back(Track::make_tie_transform(ori, railOffset, tieOffset));
+				nextTie += tieSpacing;
+			}
+			length += span;
+		}
+
+		chunk.firstSample = started ? sampleCount - 1 : 0;
+		chunk.spanCount = chunk.frames.size() - 1;
+		chunk.sBegin = sFirst;
+		chunk.distance = trackLength;
+		chunk.length = length;
+		sink(chunk);
+
+		workingSetBytes = glm::max(workingSetBytes, sourceBytes + working_set());
+		lastFrame = newFrames.back();
+		lastS = s;
+		started = true;
+		sampleCount += total;
+		tieCount += chunk.tieTransforms.size();
+		chunkCount++;
+		trackLength += length;
+		nextSegment += nSegments;
+		points.erase(points.begin(), points.end() - 3);
+	}
+
+	// Bytes reserved by every buffer the streamer holds
+	size_t working_set()
+	{
+		return (points.capacity() + head.capacity()) * sizeof(glm::vec3) +
+			segments.capacity() * sizeof(SplineSegment) + counts.capacity() * sizeof(int) + params.capacity() * sizeof(float) +
+			(samples.px.capacity() + samples.py.capacity() + samples.pz.capacity() + samples.tx.capacity() + samples.ty.capacity() + samples.tz.capacity()) * sizeof(float) +
+			(newFrames.capacity() + chunk.frames.capacity()) * sizeof(Orientation) + chunk.railVertices.capacity() * sizeof(Vertex) +
+			chunk.railIndices.capacity() * sizeof(unsigned int) + chunk.tieTransforms.capacity() * sizeof(glm::mat4);
+	}
+};
+
+// A sink appending every chunk to a file: a record of firstSample, spanCount, sBegin, distance, length and the
+//   vertex, index and tie counts, followed by the rail vertices, rail indices and tie transforms
+class TrackStreamFile
+{
+public:
+	size_t bytesWritten = 0;
+
+	TrackStreamFile(const std::string& path)
+	{
+		file = fopen(path.c_str(), "wb");
+	}
+
+	~TrackStreamFile()
+	{
+		if (file)
+			fclose(file);
+	}
+
+	TrackStreamFile(const TrackStreamFile&) = delete;
+	TrackStreamFile& operator=(const TrackStreamFile&) = delete;
+
+	bool is_open() { return file != NULL; }
+
+	void write(const TrackStreamChunk& chunk)
+	{
+		if (!file)
+			return;
+		long long counts[5] = { chunk.firstSample, chunk.spanCount, (long long)chunk.railVertices.size(), (long long)chunk.railIndices.size(), (long long)chunk.tieTransforms.size() };
+		double position[3] = { chunk.sBegin, chunk.distance, chunk.length };
+		bytesWritten += fwrite(counts, 1, sizeof(counts), file);
+		bytesWritten += fwrite(position, 1, sizeof(position), file);
+		bytesWritten += fwrite(chunk.railVertices.data(), 1, chunk.railVertices.size() * sizeof(Vertex), file);
+		bytesWritten += fwrite(chunk.railIndices.data(), 1, chunk.railIndices.size() * sizeof(unsigned int), file);
+		bytesWritten += fwrite(chunk.tieTransforms.data(), 1, chunk.tieTransforms.size() * sizeof(glm::mat4), file);
+	}
+
+	TrackStreamer::Sink sink()
+	{
+		return [this](const TrackStreamChunk& chunk) { write(chunk); };
+	}
+
+private:
+	FILE* file = NULL;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+// Many trains of several cars each, on one or more tracks
+//   Every car is kept in structure of arrays, the cars of a train side by side and the trains of a track together.
+//   A step places the cars behind their lead car, looks up their s in the arc length table, evaluates every car
+//   of a track in one batch with the spline SIMD kernels, then moves each train by the speed its energy leaves at
+//   the mean height of its cars (the same model as Ride). The cars of a train keep carSpacing between them, and a
+//   train that closes to within minimumGap of the train ahead is braked to its speed
+//   update_transforms() writes one model matrix per car for instanced drawing
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <ride.hpp>
+#include <spline_simd.hpp>
+#include <track.hpp>
+
+// The trains on one track
+class TrainFleet
+{
+public:
+	Track* track;
+	RideParameters parameters;
+	// closest the front car of a train may come to the last car of the train ahead
+	float minimumGap = 1.0f;
+
+	// per train: distance of the front car, speed, energy per unit mass, first car and number of cars, length front to back
+	std::vector<float> trainDistance;
+	std::vector<float> trainVelocity;
+	std::vector<float> trainEnergy;
+	std::vector<int> trainFirstCar;
+	std::vector<int> trainCars;
+	std::vector<float> trainLength;
+
+	// per car: distance behind the front car, distance along the track, s, and the position and tangent at s
+	std::vector<float> carOffset;
+	std::vector<float> carDistance;
+	std::vector<float> carParam;
+	SplineSamples carSamples;
+
+	TrainFleet(Track& fleetTrack, RideParameters rideParameters = RideParameters())
+	{
+		track = &fleetTrack;
+		parameters = rideParameters;
+	}
+
+	size_t train_count() const { return trainDistance.size(); }
+	size_t car_count() const { return carOffset.size(); }
+
+	// Add a train of cars with its front car at distance, it starts with the energy a Ride starts with
+	void add_train(float distance, int cars, float carSpacing)
+	{
+		cars = glm::max(cars, 1);
+		distance = fmod(distance, track->trackLength);
+		if (distance < 0.0f)
+			distance += track->trackLength;
+
+		trainDistance.push_back(distance);
+		trainVelocity.push_back(0.0f);
+		trainEnergy.push_back(parameters.gravity * (track->hmax + parameters.headroom));
+		trainFirstCar.push_back(carOffset.size());
+		trainCars.push_back(cars);
+		trainLength.push_back(float(cars - 1) * carSpacing);
+		for (int c = 0; c < cars; c++)
+			carOffset.push_back(float(c) * carSpacing);
+
+		size_t n = carOffset.size();
+		carDistance.resize(n);
+		carParam.resize(n);
+		carSamples.px.resize(n);
+		carSamples.py.resize(n);
+		carSamples.pz.resize(n);
+		carSamples.tx.resize(n);
+		carSamples.ty.resize(n);
+		carSamples.tz.resize(n);
+
+		//trains never pass each other, so the order round the track only changes when one is added
+		order.resize(train_count());
+		for (size_t t = 0; t < order.size(); t++)
+			order[t] = t;
+		std::sort(order.begin(), order.end(), [this](int a, int b) { return trainDistance[a] < trainDistance[b]; });
+		place_cars();
+	}
+
+	// Spread count trains of cars evenly round the track
+	void add_trains(int count, int cars, float carSpacing)
+	{
+		for (int t = 0; t < count; t++)
+			add_train(track->trackLength * float(t) / float(count), cars, carSpacing);
+	}
+
+	// One fixed step of every train on the track
+	void step(float dt)
+	{
+		float length = track->trackLength;
+		float g = parameters.gravity;
+
+		//speed from the energy at the mean height of the cars, then move and take off the losses
+		for (size_t t = 0; t < train_count(); t++) {
+			const float* height = carSamples.py.data() + trainFirstCar[t];
+			float h = 0.0f;
+			for (int c = 0; c < trainCars[t]; c++)
+				h += height[c];
+			h /= float(trainCars[t]);
+
+			float v = sqrt(glm::max(2.0f * (trainEnergy[t] - g * h), 0.0f));
+			if (v < parameters.liftSpeed) {
+				v = parameters.liftSpeed;
+				trainEnergy[t] = 0.5f * v * v + g * h;
+			}
+			trainEnergy[t] -= (parameters.friction * g + parameters.drag * v * v) * v * dt;
+			trainVelocity[t] = v;
+			trainDistance[t] += v * dt;
+			if (trainDistance[t] >= length)
+				trainDistance[t] -= length;
+		}
+
+		//block brake: a train too close to the one ahead is held back and slowed to its speed
+		int nTrains = order.size();
+		if (nTrains > 1) {
+			for (int k = 0; k < nTrains; k++) {
+				int t = order[k];
+				int ahead = order[(k + 1) % nTrains];
+				float gap = trainDistance[ahead] - trainLength[ahead] - trainDistance[t];
+				gap -= length * floor(gap / length);
+				if (gap < minimumGap && trainVelocity[t] > trainVelocity[ahead]) {
+					trainDistance[t] -= minimumGap - gap;
+					if (trainDistance[t] < 0.0f)
+						trainDistance[t] += length;
+					float v = trainVelocity[ahead];
+					trainEnergy[t] -= 0.5f * (trainVelocity[t] * trainVelocity[t] - v * v);
+					trainVelocity[t] = v;
+				}
+			}
+		}
+
+		place_cars();
+	}
+
+	// Model matrix of every car into out[first...], carModel places the car model on its own frame
+	void update_transforms(const glm::mat4& carModel, glm::mat4* out)
+	{
+		for (size_t i = 0; i < car_count(); i++)
+			out[i] = car_transform(*track, carParam[i], glm::vec3(carSamples.px[i], carSamples.py[i], carSamples.pz[i]), carModel);
+	}
+
+	// Model matrix of a car at s on track, sitting a fifth above the rail centre line at position like the ridden car
+	static glm::mat4 car_transform(Track& track, double s, glm::vec3 position, const glm::mat4& carModel)
+	{
+		glm::vec3 origin;
+		glm::quat rotation;
+		track.get_pose(s, origin, rotation);
+		glm::mat4 frame = glm::mat4_cast(rotation);
+		frame[3] = glm::vec4(position + glm::vec3(frame[1]) / 5.0f, 1.0f);
+		return frame * carModel;
+	}
+
+private:
+	// trains in order round the track
+	std::vector<int> order;
+
+	// Put every car behind its front car and evaluate the spline at all of them in one batch
+	void place_cars()
+	{
+		float length = track->trackLength;
+		for (size_t t = 0; t < train_count(); t++) {
+			float lead = trainDistance[t];
+			float* distance = carDistance.data() + trainFirstCar[t];
+			const float* offset = carOffset.data() + trainFirstCar[t];
+			for (int c = 0; c < trainCars[t]; c++) {
+				float d = lead - offset[c];
+				distance[c] = d < 0.0f ? d + length : d;
+			}
+		}
+
+		for (size_t i = 0; i < car_count(); i++)
+			carParam[i] = track->get_param(carDistance[i]);
+
+		SplineBatch batch;
+		batch.coefficients = &track->segments[0].a.x;
+		batch.nSegments = track->segments.size();
+		batch.sBegin = 0.0f;
+		batch.step = 0.0f;
+		batch.params = carParam.data();
+		batch.position[0] = carSamples.px.data();
+		batch.position[1] = carSamples.py.data();
+		batch.position[2] = carSamples.pz.data();
+		batch.tangent[0] = carSamples.tx.data();
+		batch.tangent[1] = carSamples.ty.data();
+		batch.tangent[2] = carSamples.tz.data();
+		sample_spline(batch, car_count(), best_spline_kernel());
+	}
+};
+
+// Every fleet in the park, stepped at a fixed rate like Ride and drawn from one array of car transforms
+class TrainSystem
+{
+public:
+	std::vector<TrainFleet> fleets;
+	// fixed step length, and the most steps run by one advance
+	float timeStep = 1.0f / 120.0f;
+	int maxSteps = 30;
+	float accumulator = 0.0f;
+	long long steps = 0;
+	// model matrix of every car of every fleet, in fleet order
+	std::vector<glm::mat4> carTransforms;
+
+	// Add the trains of a track, returns its fleet
+	TrainFleet& add_fleet(Track& track, RideParameters parameters = RideParameters())
+	{
+		fleets.push_back(TrainFleet(track, parameters));
+		return fleets.back();
+	}
+
+	size_t car_count() const
+	{
+		size_t cars = 0;
+		for (const TrainFleet& fleet : fleets)
+			cars += fleet.car_count();
+		return cars;
+	}
+
+	// Simulate frameTime more seconds in whole steps
+	void advance(float frameTime)
+	{
+		accumulator += glm::max(frameTime, 0.0f);
+		int taken = 0;
+		while (accumulator >= timeStep && taken < maxSteps) {
+			step();
+			accumulator -= timeStep;
+			taken++;
+		}
+		if (taken == maxSteps)
+			accumulator = fmod(accumulator, timeStep);
+	}
+
+	void step()
+	{
+		for (TrainFleet& fleet : fleets)
+			fleet.step(timeStep);
+		steps++;
+	}
+
+	// Fill carTransforms from the current state
+	void update_transforms(const glm::mat4& carModel)
+	{
+		carTransforms.resize(car_count());
+		size_t first = 0;
+		for (TrainFleet& fleet : fleets) {
+			fleet.update_transforms(carModel, carTransforms.data() + first);
+			first += fleet.car_count();
+		}
+	}
+};
@@ -0,0 +1,44 @@
+#version 330 core
+// Heightmap drawn from its height texture: one small grid is drawn once per tile of the heightmap, and each vertex
+// is lifted to the height of its texel with a normal from the heights either side, as Heightmap::create_mesh does
+layout (location = 0) in vec2 aGrid;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+// one texel per heightmap texel, a row of the heightmap along s
+uniform sampler2D heights;
+// cells a side of the grid, and tiles across a row of tiles
+uniform int gridSize;
+uniform int tilesAcross;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+float height_at(ivec2 texel)
+{
+    return texelFetch(heights, texel.yx, 0).r;
+}
+
+void main()
+{
+    // rows and columns, the grid of the last tiles is clamped to the edge
+    ivec2 size = textureSize(heights, 0).yx;
+    ivec2 tile = ivec2(gl_InstanceID / tilesAcross, gl_InstanceID % tilesAcross);
+    ivec2 texel = min(tile * gridSize + ivec2(aGrid), size - 1);
+
+    // central differences, one sided at the edges
+    ivec2 before = max(texel - 1, 0);
+    ivec2 after = min(texel + 1, size - 1);
+    vec2 cell = 2.0 / vec2(size - 1);
+    float dhdx = (height_at(ivec2(after.x, texel.y)) - height_at(ivec2(before.x, texel.y))) / (float(after.x - before.x) * cell.x);
+    float dhdz = (height_at(ivec2(texel.x, after.y)) - height_at(ivec2(texel.x, before.y))) / (float(after.y - before.y) * cell.y);
+
+    TexCoords = vec2(texel) / vec2(size - 1);
+    FragPos = vec3(model * vec4(2.0 * TexCoords.x - 1.0, height_at(texel), 2.0 * TexCoords.y - 1.0, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normalize(vec3(-dhdx, 1.0, -dhdz));
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
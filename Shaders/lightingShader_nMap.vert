@@ -4,6 +4,7 @@ layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 layout (location = 3) in vec3 aTangent;
 layout (location = 4) in vec3 aBitangent;
+layout (location = 5) in mat4 aInstanceModel;
 
 out VS_OUT {
     vec3 FragPos;
@@ -17,17 +18,19 @@ out VS_OUT {
 uniform mat4 projection;
 uniform mat4 view;
 uniform mat4 model;
+uniform bool instanced;
 
 uniform vec3 lightPos;
 uniform vec3 viewPos;
 
 void main()
 {
-    vs_out.FragPos = vec3(model * vec4(aPos, 1.0));   
+    mat4 instanceModel = instanced ? model * aInstanceModel : model;
+    vs_out.FragPos = vec3(instanceModel * vec4(aPos, 1.0));   
     vs_out.TexCoords = aTexCoords;
     
-    vec3 T = normalize(vec3(model * vec4(aTangent, 0.0)));
-    vec3 N = normalize(vec3(model * vec4(aNormal, 0.0)));
+    vec3 T = normalize(vec3(instanceModel * vec4(aTangent, 0.0)));
+    vec3 N = normalize(vec3(instanceModel * vec4(aNormal, 0.0)));
     // re-orthogonalize T with respect to N
     T = normalize(T - dot(T, N) * N);
     // then retrieve perpendicular vector B with the cross product of T and N
@@ -39,6 +42,6 @@ void main()
     vs_out.TangentViewPos  = vs_out.TBN * viewPos;
     vs_out.TangentFragPos  = vs_out.TBN * vs_out.FragPos;
         
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * instanceModel * vec4(aPos, 1.0);
 }
 
@@ -0,0 +1,76 @@
+#version 330 core
+// Rails built from the track frames, there are no vertex attributes or indices
+// Each draw covers a run of samples at one level of detail, gl_VertexID picks the segment between two rings
+// and the corner of its triangles in the same order as Track::make_rail_indices, the ring vertex as in Track::make_rail_ring
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+// 2 texels per sample: origin (texture v in w), rotation quaternion (x, y, z, w) taking x and y to Right and Up
+uniform samplerBuffer frames;
+uniform int frameCount;
+uniform vec3 railOffset;
+// the run drawn: samples [firstSample, endSample) every stride th one, the simple profile leaves out the bottom faces
+uniform int firstSample;
+uniform int endSample;
+uniform int stride;
+uniform bool simple;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// corner of the rail box for each vertex pair, x across the rail and y up, and the face normal in the same terms
+const vec2 corners[8] = vec2[8](
+    vec2(-1.0, 1.0), vec2(1.0, 1.0),    // top
+    vec2(-1.0, -1.0), vec2(1.0, -1.0),  // bottom
+    vec2(-1.0, 1.0), vec2(-1.0, -1.0),  // left
+    vec2(1.0, 1.0), vec2(1.0, -1.0)     // right
+);
+const vec2 normals[4] = vec2[4](vec2(0.0, 1.0), vec2(0.0, -1.0), vec2(-1.0, 0.0), vec2(1.0, 0.0));
+
+// faces kept by the simple profile
+const int simpleFaces[6] = int[6](0, 2, 3, 4, 6, 7);
+// the two triangles of a face quad as (next ring, vertex of the pair), the bottom and left faces are flipped
+const ivec2 quad[6] = ivec2[6](ivec2(0, 0), ivec2(0, 1), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1), ivec2(1, 0));
+const ivec2 flippedQuad[6] = ivec2[6](ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(0, 1), ivec2(1, 0), ivec2(1, 1));
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    int segmentIndices = simple ? 36 : 48;
+    int segment = gl_VertexID / segmentIndices;
+    int index = gl_VertexID % segmentIndices;
+    int face = simple ? simpleFaces[index / 6] : index / 6;
+    bool flip = (face % 4 == 1) || (face % 4 == 2);
+    ivec2 pick = flip ? flippedQuad[index % 6] : quad[index % 6];
+
+    // the last segment of a run stops at its end, the end of the track is ring 0
+    int sampleIndex = firstSample + segment * stride;
+    if (pick.x == 1)
+        sampleIndex = min(sampleIndex + stride, endSample) % frameCount;
+    int vertex = face * 2 + pick.y;
+    int rail = vertex / 8;
+    int corner = vertex % 8;
+
+    vec4 origin = texelFetch(frames, sampleIndex * 2);
+    vec4 rotation = texelFetch(frames, sampleIndex * 2 + 1);
+    vec3 up = rotate(rotation, vec3(0.0, 1.0, 0.0));
+    vec3 right = rotate(rotation, vec3(1.0, 0.0, 0.0));
+
+    // first rail on the right, second on the left
+    vec3 center = origin.xyz + right * (rail == 0 ? 0.1 : -0.1);
+    vec3 position = center + right * railOffset * corners[corner].x + up * railOffset * corners[corner].y;
+    vec3 normal = right * normals[corner / 2].x + up * normals[corner / 2].y;
+
+    FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normal;
+    TexCoords = vec2(float(corner % 2), origin.w);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
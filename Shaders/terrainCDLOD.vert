@@ -0,0 +1,59 @@
+#version 330 core
+// Terrain tiles of the CDLOD quadtree, the one grid stretched over each tile and lifted by the height texture
+// aGrid is the corner of the grid in cells, aTile the tile as (first row, first column, size in cells, level)
+layout (location = 0) in vec2 aGrid;
+layout (location = 1) in vec4 aTile;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+// one texel per heightmap texel, a row of the heightmap along s
+uniform sampler2D heights;
+// rows and columns of the heightmap
+uniform vec2 heightsSize;
+uniform float gridSize;
+uniform vec3 cameraPos;
+// distance at which each level starts and finishes morphing into the next, as Terrain::morphRanges
+uniform vec2 morphRanges[16];
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// bilinear height at a row and column
+float height_at(vec2 texel)
+{
+    return texture(heights, (texel.yx + 0.5) / heightsSize.yx).r;
+}
+
+// the heightmap mesh spans -1 to 1 over the rows in x and the columns in z
+vec3 local_position(vec2 texel)
+{
+    vec2 xz = 2.0 * texel / (heightsSize - 1.0) - 1.0;
+    return vec3(xz.x, height_at(texel), xz.y);
+}
+
+void main()
+{
+    float spacing = aTile.z / gridSize;
+    vec2 texel = min(aTile.xy + aGrid * spacing, heightsSize - 1.0);
+
+    // slide the odd vertices onto the even ones over the morph range, by the distance of the unmorphed vertex
+    // so both tiles on an edge move it the same way
+    vec2 range = morphRanges[int(aTile.w)];
+    float k = clamp((distance(vec3(model * vec4(local_position(texel), 1.0)), cameraPos) - range.x) / (range.y - range.x), 0.0, 1.0);
+    texel = min(aTile.xy + (aGrid - 2.0 * fract(0.5 * aGrid) * k) * spacing, heightsSize - 1.0);
+
+    // normal from central differences a grid spacing either side
+    vec2 dx = vec2(spacing, 0.0);
+    vec2 dz = vec2(0.0, spacing);
+    vec2 slope = vec2(height_at(texel + dx) - height_at(texel - dx), height_at(texel + dz) - height_at(texel - dz))
+        * (heightsSize - 1.0) / (4.0 * spacing);
+
+    FragPos = vec3(model * vec4(local_position(texel), 1.0));
+    Normal = mat3(transpose(inverse(model))) * normalize(vec3(-slope.x, 1.0, -slope.y));
+    TexCoords = texel / (heightsSize - 1.0);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
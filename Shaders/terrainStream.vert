@@ -0,0 +1,49 @@
+#version 330 core
+// Tiles of a streamed terrain, the one grid stretched over each tile and lifted by its layer of the tile texture
+// aGrid is the corner of the grid in cells, aTile the tile as (tile row, tile column, layer)
+layout (location = 0) in vec2 aGrid;
+layout (location = 1) in vec3 aTile;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+// a layer of tileSize + 1 samples a side and a border of tileBorder all round per tile on the GPU, a row of the tile along s
+uniform sampler2DArray tiles;
+uniform float tileSize;
+uniform float tileBorder;
+uniform float gridSize;
+// rows and columns of samples in the whole terrain
+uniform vec2 terrainSize;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+// bilinear height at a row and column within the tile, the border lies before 0 and after tileSize
+float height_at(vec2 tileTexel)
+{
+    return texture(tiles, vec3((tileTexel.yx + tileBorder + 0.5) / (tileSize + 1.0 + 2.0 * tileBorder), aTile.z)).r;
+}
+
+void main()
+{
+    // the grid of the last tiles is clamped to the edge of the terrain
+    float spacing = tileSize / gridSize;
+    vec2 first = aTile.xy * tileSize;
+    vec2 texel = min(first + aGrid * spacing, terrainSize - 1.0);
+    vec2 tileTexel = texel - first;
+
+    // central differences a sample either side as heightmapDisplace.vert, reaching into the border at the edges of
+    // the tile so neighbouring tiles light a shared vertex the same, and one sided only at the edge of the terrain
+    vec2 before = max(texel - 1.0, 0.0) - first;
+    vec2 after = min(texel + 1.0, terrainSize - 1.0) - first;
+    vec2 slope = vec2(height_at(vec2(after.x, tileTexel.y)) - height_at(vec2(before.x, tileTexel.y)),
+        height_at(vec2(tileTexel.x, after.y)) - height_at(vec2(tileTexel.x, before.y))) / (after - before) * (terrainSize - 1.0) * 0.5;
+
+    TexCoords = texel / (terrainSize - 1.0);
+    FragPos = vec3(model * vec4(2.0 * TexCoords.x - 1.0, height_at(tileTexel), 2.0 * TexCoords.y - 1.0, 1.0));
+    Normal = mat3(transpose(inverse(model))) * normalize(vec3(-slope.x, 1.0, -slope.y));
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -0,0 +1,55 @@
+#version 330 core
+// Ties placed from the track frames, each instance only carries where along the frames it sits
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in float aTieFrame;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+// 2 texels per sample: origin (texture v in w), rotation quaternion (x, y, z, w) taking x, y and -z to Right, Up and Front
+uniform samplerBuffer frames;
+uniform int frameCount;
+uniform vec3 railOffset;
+uniform vec3 tieOffset;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+vec3 rotate(vec4 q, vec3 v)
+{
+    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main()
+{
+    // blend the frames on either side of the tie, the same as FrameTable::blend behind Track::get_orientation:
+    // the origin linearly and the rotation by nlerp along the shorter arc, so the axes stay orthonormal
+    int prev = int(aTieFrame);
+    int next = (prev + 1) % frameCount;
+    float blend = aTieFrame - float(prev);
+
+    vec3 origin = mix(texelFetch(frames, prev * 2).xyz, texelFetch(frames, next * 2).xyz, blend);
+    vec4 from = texelFetch(frames, prev * 2 + 1);
+    vec4 to = texelFetch(frames, next * 2 + 1);
+    vec4 rotation = normalize(mix(from, dot(from, to) < 0.0 ? -to : to, blend));
+    vec3 front = -rotate(rotation, vec3(0.0, 0.0, 1.0));
+    vec3 up = rotate(rotation, vec3(0.0, 1.0, 0.0));
+    vec3 right = rotate(rotation, vec3(1.0, 0.0, 0.0));
+
+    // the unit tie box to the track, the same transform as Track::create_ties
+    mat4 tieModel = mat4(vec4(right * tieOffset, 0.0),
+                         vec4(up * (0.05 - railOffset.y), 0.0),
+                         vec4(front * railOffset, 0.0),
+                         vec4(origin - up * railOffset, 1.0));
+    mat4 instanceModel = model * tieModel;
+
+    FragPos = vec3(instanceModel * vec4(aPos, 1.0));
+    Normal = mat3(transpose(inverse(instanceModel))) * normalize(aNormal);
+    TexCoords = aTexCoords;
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
@@ -72,11 +72,18 @@ int main()
 	// build and compile shaders
 	// -------------------------
 	Shader lightingShader_basic("../Project_2/Shaders/lightingShader_basic.vert", "../Project_2/Shaders/lightingShader_basic.frag");
+	Shader lightingShader_instanced("../Project_2/Shaders/lightingShader_instanced.vert", "../Project_2/Shaders/lightingShader_basic.frag");
+	// with GPU extrusion the track shaders build the rails and ties from the frames
+	Shader trackShader = extrudeTrackOnGPU ? Shader("../Project_2/Shaders/railExtrude.vert", "../Project_2/Shaders/lightingShader_basic.frag") : lightingShader_basic;
+	Shader tieShader = extrudeTrackOnGPU ? Shader("../Project_2/Shaders/tieExtrude.vert", "../Project_2/Shaders/lightingShader_basic.frag") : lightingShader_instanced;
 	Shader reflectionShader("../Project_2/Shaders/reflectionShader.vert", "../Project_2/Shaders/reflectionShader.frag");
 	Shader skyboxShader("../Project_2/Shaders/skyboxShader.vert", "../Project_2/Shaders/skyboxShader.frag");
 	Shader lightingShader_specular("../Project_2/Shaders/lightingShader_specular.vert", "../Project_2/Shaders/lightingShader_specular.frag");
 	Shader normalShader("../Project_2/Shaders/normal.vert", "../Project_2/Shaders/normal.frag", "../Project_2/Shaders/normal.geom");
 	Shader lightingShader_nMap("../Project_2/Shaders/lightingShader_nMap.vert", "../Project_2/Shaders/lightingShader_nMap.frag");
+	Shader heightmapShader = displaceHeightmapOnGPU ? Shader("../Project_2/Shaders/heightmapDisplace.vert", "../Project_2/Shaders/lightingShader_basic.frag") : lightingShader_basic;
+	Shader terrainShader = drawTerrainLOD ? Shader("../Project_2/Shaders/terrainCDLOD.vert", "../Project_2/Shaders/lightingShader_basic.frag") : lightingShader_basic;
+	Shader terrainStreamShader = streamTerrain ? Shader("../Project_2/Shaders/terrainStream.vert", "../Project_2/Shaders/lightingShader_basic.frag") : lightingShader_basic;
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// These are vertices for cubes
@@ -170,14 +177,52 @@ int main()
 	unsigned int cubemapTexture = loadCubemap(faces);
 
 	// initialize heatmap
-	Heightmap heightmap("../Project_2/Media/heightmaps/hflab4.jpg");
+	Heightmap heightmap("../Project_2/Media/heightmaps/hflab4.jpg", !displaceHeightmapOnGPU);
 	unsigned int heightmap_texture = loadTexture("../Project_2/Media/skybox_old/bottom.jpg");
+	TerrainStream terrainStream;
+	if (streamTerrain) {
+		std::string tilesPath = "../Project_2/Media/heightmaps/terrain.rht";
+		if (!terrainStream.open(tilesPath, heightmap.model)) {
+			const std::vector<float>& heights = heightmap.get_heights();
+			int columns = heightmap.columns();
+			write_height_tiles(tilesPath, heightmap.rows(), columns, 64, HEIGHT_TILES_UINT16, [&](int x, float* out) {
+				std::copy(heights.begin() + size_t(x) * columns, heights.begin() + size_t(x + 1) * columns, out);
+			});
+			terrainStream.open(tilesPath, heightmap.model);
+		}
+	}
+	// the quadtree is only built when it is drawn, the stream takes its place when it is open
+	std::unique_ptr<Terrain> terrain;
+	if (drawTerrainLOD && !terrainStream.is_open())
+		terrain.reset(new Terrain(heightmap.get_heights().data(), heightmap.rows(), heightmap.columns(), heightmap.model, TerrainParameters(), heightmap.get_height_texture()));
 	unsigned int diffuseMap = loadTexture("../Project_2/Media/textures/container2.png");
 	unsigned int specularMap = loadTexture("../Project_2/Media/textures/container2_specular.png");
 	unsigned int rail = loadTexture("../Project_2/Media/textures/rail.png");
 
 	// initialize track object
-	Track track("spline/track.sp");
+	TrackParameters trackParameters;
+	trackParameters.adaptive = adaptiveTrack;
+	trackParameters.gpuExtrusion = extrudeTrackOnGPU;
+	trackParameters.meshCache = cacheTrackMesh;
+	Track track("spline/track.sp", trackParameters);
+	if (compileTrack && !track.save_binary("spline/track.spb"))
+		std::cout << "could not write spline/track.spb" << std::endl;
+
+	// ride physics, stepped at a fixed rate whatever the frame rate
+	Ride ride(track);
+
+	// the other trains in the park, braking for the train ahead costs energy so they need a chain lift
+	TrainSystem trains;
+	RideParameters trainPhysics;
+	trainPhysics.liftSpeed = 0.5f;
+	trains.add_fleet(track, trainPhysics).add_trains(parkTrains, trainCars, trainCarSpacing);
+	// model matrix of every train car, refilled each frame and drawn instanced
+	unsigned int carInstanceVBO;
+	glGenBuffers(1, &carInstanceVBO);
+
+#ifdef RUN_BENCHMARKS
+	run_benchmarks(track);
+#endif
 
 
 	// positions of the point lights
@@ -206,6 +251,14 @@ int main()
 	lightingShader_basic.use();
 	lightingShader_basic.setInt("material.diffuse", 0);
 
+	lightingShader_instanced.use();
+	lightingShader_instanced.setInt("material.diffuse", 0);
+
+	trackShader.use();
+	trackShader.setInt("material.diffuse", 0);
+	tieShader.use();
+	tieShader.setInt("material.diffuse", 0);
+
 	lightingShader_specular.use();
 	lightingShader_specular.setInt("material.diffuse", 0);
 	lightingShader_specular.setInt("material.specular", 1);
@@ -215,6 +268,11 @@ int main()
 	lightingShader_nMap.setInt("material.specular", 1);
 	lightingShader_nMap.setInt("material.normal", 2);
 
+	// step the ride and the trains on their own thread from here on, the render loop draws their snapshots
+	Simulation simulation(track, ride, trains);
+	simulation.start();
+	std::vector<glm::mat4> carTransforms;
+
 	// render loop
 	// -----------
 	while (!glfwWindowShouldClose(window))
@@ -232,9 +290,11 @@ int main()
 		processInput(window);
 
 
-		// get camera position
+		// get camera position from the newest simulation snapshot
+		simulation.riding = camera.onTrack;
+		simulation.update();
 		if (camera.onTrack) {
-			camera.ProcessTrackMovement(deltaTime, track, window);
+			camera.ProcessTrackMovement(track, simulation.ride_state());
 		}
 
 
@@ -261,6 +321,19 @@ int main()
 		lightingShader_basic.setMat4("view", view);
 		lightingShader_basic.setMat4("projection", projection);
 
+		lightingShader_instanced.use();
+		lightingShader_instanced.setMat4("view", view);
+		lightingShader_instanced.setMat4("projection", projection);
+
+		if (extrudeTrackOnGPU) {
+			trackShader.use();
+			trackShader.setMat4("view", view);
+			trackShader.setMat4("projection", projection);
+			tieShader.use();
+			tieShader.setMat4("view", view);
+			tieShader.setMat4("projection", projection);
+		}
+
 		lightingShader_specular.use();
 		lightingShader_specular.setMat4("model", model);
 		lightingShader_specular.setMat4("view", view);
@@ -271,9 +344,38 @@ int main()
 		lightingShader_nMap.setMat4("view", view);
 		lightingShader_nMap.setMat4("projection", projection);
 
+		if (displaceHeightmapOnGPU) {
+			heightmapShader.use();
+			heightmapShader.setMat4("view", view);
+			heightmapShader.setMat4("projection", projection);
+		}
+
+		if (terrain) {
+			terrainShader.use();
+			terrainShader.setMat4("view", view);
+			terrainShader.setMat4("projection", projection);
+		}
+
+		if (streamTerrain) {
+			terrainStreamShader.use();
+			terrainStreamShader.setMat4("view", view);
+			terrainStreamShader.setMat4("projection", projection);
+		}
+
 		set_lighting(lightingShader_basic, pointLightPositions);
+		set_lighting(lightingShader_instanced, pointLightPositions);
+		if (extrudeTrackOnGPU) {
+			set_lighting(trackShader, pointLightPositions);
+			set_lighting(tieShader, pointLightPositions);
+		}
 		set_lighting(lightingShader_specular, pointLightPositions);
 		set_lighting(lightingShader_nMap, pointLightPositions);
+		if (displaceHeightmapOnGPU)
+			set_lighting(heightmapShader, pointLightPositions);
+		if (terrain)
+			set_lighting(terrainShader, pointLightPositions);
+		if (streamTerrain)
+			set_lighting(terrainStreamShader, pointLightPositions);
 
 
 		// Turn rotation rate into quaternion and cumulate the rotations
@@ -283,7 +385,15 @@ int main()
 
 		// Draw the track
 		if (drawTrack) {
-			track.Draw(lightingShader_basic, rail, diffuseMap);
+			if (tieSpacing != track.tieSpacing)
+				track.set_tie_spacing(tieSpacing);
+			track.screenHeight = (float)SCR_HEIGHT;
+			track.Draw(trackShader, tieShader, projection, view, rail, diffuseMap);
+			if (printTrackInfo) {
+				std::printf("Track chunks: %d visible, %d culled, %d triangles\n", track.visibleChunks, track.culledChunks, track.visibleTriangles);
+				std::printf("Track LOD chunks: %d %d %d %d\n\n", track.lodChunks[0], track.lodChunks[1], track.lodChunks[2], track.lodChunks[3]);
+				printTrackInfo = false;
+			}
 		}
 
 
@@ -373,9 +483,19 @@ int main()
 		}
 
 		// Draw the heightmap
-		if (drawHeightmap)
+		if (drawHeightmap && terrainStream.is_open())
 		{
-			heightmap.Draw(lightingShader_basic, heightmap_texture);
+			terrainStream.update(camera.Position);
+			terrainStream.Draw(terrainStreamShader, heightmap_texture, projection, view);
+		}
+		else if (drawHeightmap && terrain)
+		{
+			terrain->select(projection, view);
+			terrain->Draw(terrainShader, heightmap_texture);
+		}
+		else if (drawHeightmap)
+		{
+			heightmap.Draw(heightmapShader, heightmap_texture);
 		}
 
 
@@ -391,6 +511,17 @@ int main()
 		// Draw the car
 		ourModel.Draw(lightingShader_nMap);
 
+		// Draw the cars of the other trains
+		glm::mat4 carModel;
+		carModel = glm::rotate(carModel, glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		carModel = glm::scale(carModel, glm::vec3(0.02f, 0.02f, 0.02f));
+		simulation.car_transforms(carModel, carTransforms);
+		glBindBuffer(GL_ARRAY_BUFFER, carInstanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, carTransforms.size() * sizeof(glm::mat4), carTransforms.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		lightingShader_nMap.setMat4("model", glm::mat4());
+		ourModel.DrawInstanced(lightingShader_nMap, carInstanceVBO, carTransforms.size());
+
 
 		// Draw the normals if desired for heightmap and nano suit
 		if (drawNormals)
@@ -398,7 +529,9 @@ int main()
 			normalShader.use();
 			normalShader.setMat4("projection", projection);
 			normalShader.setMat4("view", view);
-			heightmap.Draw(normalShader, heightmap_texture);
+			// the displaced heightmap has no vertex normals to show
+			if (!displaceHeightmapOnGPU)
+				heightmap.Draw(normalShader, heightmap_texture);
 
 			normalShader.use();
 			normalShader.setMat4("model", model);
@@ -432,7 +565,11 @@ int main()
 	glDeleteBuffers(1, &VBO);
 	glDeleteBuffers(1, &skyboxVAO);
 	heightmap.delete_buffers();
+	if (terrain)
+		terrain->delete_buffers();
+	terrainStream.close();
 
+	simulation.stop();
 	glfwTerminate();
 	return 0;
 }
@@ -479,6 +616,12 @@ void processInput(GLFWwindow *window)
 	if (glfwGetKey(window, GLFW_KEY_PERIOD))
 		step_multiplier /= 1.01f;
 
+	// change the distance between ties
+	if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET))
+		tieSpacing = glm::min(tieSpacing * 1.01f, 2.0f);
+	if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET))
+		tieSpacing = glm::max(tieSpacing / 1.01f, 0.05f);
+
 	// update step based on framerate (prevents excessive changes)
 	float step = deltaTime * step_multiplier;
 
@@ -551,6 +694,7 @@ void processInput(GLFWwindow *window)
 			std::printf("Front (%.05f,%.05f,%.05f)\n", camera.Front.x, camera.Front.y, camera.Front.z);
 			use_quats ? std::printf("Using quaternions\n") : std::printf("Not Using quaternions\n");
 			std::printf("\n");
+			printTrackInfo = true;
 		}
 
 
@@ -13,33 +13,152 @@
 #include "rc_spline.h"
 
 
-/* load a spline segment from a file */
+/* read a whole file into memory with one buffered read */
+bool rc_Spline::readFile(const std::string& filename, std::string& contents)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	contents.resize(size > 0 ? size : 0);
+	size_t read = size > 0 ? fread(&contents[0], 1, size, file) : 0;
+	contents.resize(read);
+
+	fclose(file);
+	return true;
+}
+
+
+/* skip spaces, tabs and line breaks */
+static void skipSpace(const char*& p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+}
+
+
+/* parse a decimal number like fscanf's %f does for the values in the spline files,
+   an optional sign, digits with an optional point and an optional exponent */
+bool rc_Spline::parseFloat(const char*& p, const char* end, float& value)
+{
+	skipSpace(p, end);
+	const char* start = p;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	/* keep up to 19 significant digits as an integer, count the rest as powers of ten */
+	unsigned long long mantissa = 0;
+	int exponent = 0, digits = 0, significant = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+		if (significant < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			significant += mantissa != 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+			if (significant < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				significant += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if (digits == 0) {
+		p = start;
+		return false;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char* e = p + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+			negativeExponent = *e++ == '-';
+		if (e < end && *e >= '0' && *e <= '9') {
+			int power = 0;
+			for (; e < end && *e >= '0' && *e <= '9'; e++)
+				power = power < 1000 ? power * 10 + (*e - '0') : power;
+			exponent += negativeExponent ? -power : power;
+			p = e;
+		}
+	}
+
+	double result = double(mantissa);
+	if (mantissa != 0)
+	{
+		double scale = 1.0, base = 10.0;
+		for (int n = exponent < 0 ? -exponent : exponent; n > 0; n >>= 1, base *= base)
+			if (n & 1)
+				scale *= base;
+		result = exponent < 0 ? result / scale : result * scale;
+	}
+
+	value = float(negative ? -result : result);
+	return true;
+}
+
+
+/* drop the least recently used segment files until at most keep are left */
+void rc_Spline::trimSegmentCache(size_t keep)
+{
+	while (m_segmentCache.size() > keep)
+	{
+		std::map<std::string, CachedSegment>::iterator oldest = m_segmentCache.begin();
+		for (std::map<std::string, CachedSegment>::iterator it = m_segmentCache.begin(); it != m_segmentCache.end(); ++it)
+			if (it->second.lastUsed < oldest->second.lastUsed)
+				oldest = it;
+		m_segmentCache.erase(oldest);
+	}
+}
+
+
+/* load a spline segment from a file, each file is only read and parsed the first time it is used,
+   or while streaming the first time since it dropped out of the cache */
 void rc_Spline::loadSegmentFrom(std::string filename)
 {	
 	filename = folder + filename;
-	FILE* fileSplineSegment = fopen(filename.c_str(), "r");
-	if (fileSplineSegment == NULL) 
+
+	std::map<std::string, CachedSegment>::iterator cached = m_segmentCache.find(filename);
+	if (cached == m_segmentCache.end())
 	{
-		printf ("can't open file %s\n", filename.c_str());
-		exit(1);
-	}
+		std::string contents;
+		if (!readFile(filename, contents))
+		{
+			printf ("can't open file %s\n", filename.c_str());
+			exit(1);
+		}
 
-	int iLength;
+		/* make room for it */
+		if (m_segmentCacheLimit > 0)
+			trimSegmentCache(m_segmentCacheLimit - 1);
 
-	/* gets length for spline segment */
-	fscanf(fileSplineSegment, "%d", &iLength);
+		pointVector& segment = m_segmentCache[filename].points;
+		const char* p = contents.data();
+		const char* end = p + contents.size();
 
-	glm::vec3 pt;
+		/* gets length for spline segment */
+		float fLength;
+		parseFloat(p, end, fLength);
+		segment.reserve(fLength > 0.0f ? int(fLength) : 0);
 
-	/* add it to the control point list */
-	while (fscanf(fileSplineSegment, "%f %f %f", 
-				&pt.x, &pt.y,&pt.z) != EOF) 
-	{
-		m_vPoints.push_back(pt);
+		/* add it to the control point list */
+		glm::vec3 pt;
+		while (parseFloat(p, end, pt.x) && parseFloat(p, end, pt.y) && parseFloat(p, end, pt.z))
+			segment.push_back(pt);
+
+		cached = m_segmentCache.find(filename);
 	}
 
-	/* now close the file */
-	fclose(fileSplineSegment);
+	cached->second.lastUsed = ++m_segmentUses;
+	m_vPoints.insert(m_vPoints.end(), cached->second.points.begin(), cached->second.points.end());
 }
 
 
@@ -48,30 +167,137 @@ void rc_Spline::loadSplineFrom(std::string filename)
 {	
 	filename = folder + filename;
 	/* load the track file */
-	FILE* fileSpline = fopen(filename.c_str(), "r");
-
-	if (fileSpline == NULL) 
+	std::string contents;
+	if (!readFile(filename, contents))
 	{
 		printf ("can't open file %s\n", filename.c_str());
 		exit(1);
 	}
+	const char* p = contents.data();
+	const char* end = p + contents.size();
   
 	/* stores the number of splines in a global variable */
-	int nSegments;
-	fscanf(fileSpline, "%d", &nSegments);
+	float fSegments = 0.0f;
+	parseFloat(p, end, fSegments);
+	int nSegments = int(fSegments);
 
 	/* reads through the spline files */
 	for (int j = 0; j < nSegments; j++) 
 	{
-		/* define a variable of a reasonable size for a filename */
-		char segmentfilename[1024];
+		skipSpace(p, end);
+		const char* name = p;
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+			p++;
+		if (p == name)
+			break;
 
-		fscanf(fileSpline, "%s", segmentfilename);
-		loadSegmentFrom(segmentfilename);
+		loadSegmentFrom(std::string(name, p));
 	}
+}
 
-	/* now close the file */
-	fclose(fileSpline);
 
 
-}
\ No newline at end of file
+/* next word of the streamed file, words split across two blocks are put back together */
+bool rc_Spline::readStreamWord(std::string& word)
+{
+	word.clear();
+	for (;;)
+	{
+		if (m_streamParsed == m_streamBlock.size())
+		{
+			m_streamBlock.resize(STREAM_BLOCK_SIZE);
+			m_streamBlock.resize(fread(&m_streamBlock[0], 1, STREAM_BLOCK_SIZE, m_stream));
+			m_streamParsed = 0;
+			if (m_streamBlock.empty())
+				return !word.empty();
+		}
+
+		const char* begin = m_streamBlock.data() + m_streamParsed;
+		const char* end = m_streamBlock.data() + m_streamBlock.size();
+		const char* p = begin;
+		if (word.empty())
+		{
+			skipSpace(p, end);
+			begin = p;
+		}
+		while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+			p++;
+		word.append(begin, p);
+		m_streamParsed = p - m_streamBlock.data();
+		if (p < end && !word.empty())
+			return true;
+	}
+}
+
+
+/* start streaming a spline from a file */
+bool rc_Spline::openStream(std::string filename)
+{
+	closeStream();
+	filename = folder + filename;
+	m_stream = fopen(filename.c_str(), "rb");
+	if (m_stream == NULL)
+		return false;
+
+	/* stores the number of splines in a global variable */
+	m_streamSegments = 0;
+	std::string word;
+	if (readStreamWord(word))
+	{
+		const char* p = word.data();
+		float fSegments;
+		if (parseFloat(p, p + word.size(), fSegments))
+			m_streamSegments = int(fSegments);
+	}
+	m_vPoints.clear();
+	m_streamNext = 0;
+	m_segmentCacheLimit = STREAM_CACHED_SEGMENTS;
+	trimSegmentCache(m_segmentCacheLimit);
+	return true;
+}
+
+
+/* read the next window of a streamed spline, one segment file at a time through the cache */
+size_t rc_Spline::readStream(pointVector& out, size_t maxPoints)
+{
+	out.clear();
+	while (m_stream != NULL && out.size() < maxPoints)
+	{
+		if (m_streamNext == m_vPoints.size())
+		{
+			std::string segmentfilename;
+			if (m_streamSegments <= 0 || !readStreamWord(segmentfilename))
+				break;
+			m_streamSegments--;
+
+			m_vPoints.clear();
+			m_streamNext = 0;
+			loadSegmentFrom(segmentfilename);
+			continue;
+		}
+
+		size_t count = m_vPoints.size() - m_streamNext;
+		if (count > maxPoints - out.size())
+			count = maxPoints - out.size();
+		out.insert(out.end(), m_vPoints.begin() + m_streamNext, m_vPoints.begin() + m_streamNext + count);
+		m_streamNext += count;
+	}
+
+	if (out.empty())
+		closeStream();
+	return out.size();
+}
+
+
+/* stop streaming */
+void rc_Spline::closeStream()
+{
+	if (m_stream != NULL)
+		fclose(m_stream);
+	m_stream = NULL;
+	m_streamSegments = 0;
+	m_streamNext = 0;
+	m_streamBlock.clear();
+	m_streamParsed = 0;
+	m_segmentCacheLimit = 0;
+}